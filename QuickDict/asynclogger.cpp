@@ -0,0 +1,178 @@
+#include "asynclogger.h"
+#include <chrono>
+
+AsyncLogger::AsyncLogger(qint64 maxFileSize, int maxBackups)
+    : m_slots(new Slot[Capacity])
+    , m_maxFileSize(maxFileSize)
+    , m_maxBackups(maxBackups)
+{
+    for (size_t i = 0; i < Capacity; ++i)
+        m_slots[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+AsyncLogger::~AsyncLogger()
+{
+    close();
+}
+
+bool AsyncLogger::open(const QString &fileName)
+{
+    if (isOpen())
+        return false;
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::Append | QIODevice::Text))
+        return false;
+    m_stopping.store(false);
+    m_finished = false;
+    m_thread = std::thread(&AsyncLogger::run, this);
+    return true;
+}
+
+void AsyncLogger::close()
+{
+    if (!isOpen())
+        return;
+    m_stopping.store(true);
+    m_wakeUp.notify_one();
+    m_thread.join();
+    m_file.close();
+}
+
+bool AsyncLogger::log(const QString &message)
+{
+    if (!push(message)) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    // the writer also wakes up by itself, a wakeup lost to the race with going to sleep only delays writing
+    if (m_sleeping.load(std::memory_order_relaxed))
+        m_wakeUp.notify_one();
+    return true;
+}
+
+bool AsyncLogger::canFlush() const
+{
+    return isOpen() && std::this_thread::get_id() != m_thread.get_id();
+}
+
+void AsyncLogger::flush()
+{
+    if (!canFlush())
+        return;
+    std::unique_lock<std::mutex> locker(m_mutex);
+    quint64 request = ++m_flushRequests;
+    m_wakeUp.notify_one();
+    m_flushed.wait(locker, [this, request]() { return m_flushedRequests >= request || m_finished; });
+}
+
+/*
+ * The ring buffer is the bounded queue by Dmitry Vyukov. Every slot has a sequence number telling whose turn it is:
+ * a producer may fill slot `pos % Capacity` when its sequence is `pos`, and the writer may empty it when its sequence
+ * is `pos + 1`. Emptying sets it to `pos + Capacity`, i.e. the turn of the producer in the next lap.
+ */
+bool AsyncLogger::push(const QString &message)
+{
+    size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+    Slot *slot;
+    for (;;) {
+        slot = &m_slots[pos & (Capacity - 1)];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+        if (diff == 0) {
+            if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            return false; // full
+        } else {
+            pos = m_enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+    slot->message = message;
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool AsyncLogger::pop(QString &message)
+{
+    Slot *slot = &m_slots[m_dequeuePos & (Capacity - 1)];
+    if (slot->sequence.load(std::memory_order_acquire) != m_dequeuePos + 1)
+        return false;
+    message = std::move(slot->message);
+    slot->message = QString();
+    slot->sequence.store(m_dequeuePos + Capacity, std::memory_order_release);
+    ++m_dequeuePos;
+    return true;
+}
+
+void AsyncLogger::run()
+{
+    const int maxBatchSize = 256 * 1024; // bytes
+    QByteArray batch;
+    QString message;
+    for (;;) {
+        // read before draining, so that messages logged before a flush request are written before it is answered
+        bool stopping = m_stopping.load();
+        quint64 flushRequests = m_flushRequests.load();
+
+        bool more = false;
+        while (pop(message)) {
+            batch += message.toUtf8();
+            batch += '\n';
+            if (batch.size() >= maxBatchSize) {
+                more = true;
+                break;
+            }
+        }
+        if (quint64 dropped = m_dropped.exchange(0, std::memory_order_relaxed))
+            batch += QString("AsyncLogger: %1 messages dropped, the ring buffer is full\n").arg(dropped).toUtf8();
+        if (!batch.isEmpty()) {
+            write(batch);
+            batch.clear();
+        }
+        if (more)
+            continue;
+
+        std::unique_lock<std::mutex> locker(m_mutex);
+        if (flushRequests > m_flushedRequests) {
+            m_file.flush();
+            m_flushedRequests = flushRequests;
+            m_flushed.notify_all();
+        }
+        if (stopping)
+            break;
+        if (m_flushRequests.load() > m_flushedRequests || m_stopping.load())
+            continue;
+        m_sleeping.store(true);
+        m_wakeUp.wait_for(locker, std::chrono::milliseconds(200));
+        m_sleeping.store(false);
+    }
+    std::lock_guard<std::mutex> locker(m_mutex);
+    m_file.flush();
+    m_finished = true;
+    m_flushed.notify_all();
+}
+
+void AsyncLogger::write(const QByteArray &data)
+{
+    if (m_maxFileSize > 0 && m_file.size() > 0 && m_file.size() + data.size() > m_maxFileSize)
+        rotate();
+    m_file.write(data);
+    // hands the batch over to the OS, so that it survives a crash of the process
+    m_file.flush();
+}
+
+void AsyncLogger::rotate()
+{
+    QString fileName = m_file.fileName();
+    m_file.close();
+    if (m_maxBackups > 0) {
+        QFile::remove(QString("%1.%2").arg(fileName).arg(m_maxBackups));
+        for (int i = m_maxBackups - 1; i >= 1; --i)
+            QFile::rename(QString("%1.%2").arg(fileName).arg(i), QString("%1.%2").arg(fileName).arg(i + 1));
+        QFile::rename(fileName, fileName + ".1");
+    } else {
+        QFile::remove(fileName);
+    }
+    m_file.setFileName(fileName);
+    m_file.open(QIODevice::Append | QIODevice::Text);
+}
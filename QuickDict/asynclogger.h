@@ -0,0 +1,87 @@
+#ifndef ASYNCLOGGER_H
+#define ASYNCLOGGER_H
+
+#include <QFile>
+#include <QString>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/**
+ * AsyncLogger writes log messages to a file on a background thread, so that threads logging never wait for the disk.
+ *
+ * Messages are passed through a bounded lock-free ring buffer, which any number of threads may log to. The writer
+ * thread drains it in batches, writing each batch at once, and rotates the file when it grows larger than
+ * `maxFileSize`: "log" is renamed to "log.1", "log.1" to "log.2" and so on, keeping at most `maxBackups` old files.
+ * Messages arriving while the ring buffer is full are dropped and counted in the log.
+ */
+class AsyncLogger
+{
+public:
+    explicit AsyncLogger(qint64 maxFileSize = 4 * 1024 * 1024, int maxBackups = 3);
+    ~AsyncLogger();
+
+    /**
+     * Opens @p fileName for appending and starts the writer thread.
+     * @return @c true if successful, @c false otherwise.
+     */
+    bool open(const QString &fileName);
+    /**
+     * Writes all logged messages and stops the writer thread.
+     */
+    void close();
+    inline bool isOpen() const { return m_thread.joinable(); }
+    inline QString fileName() const { return m_file.fileName(); }
+
+    /**
+     * Queues @p message as a line. Never blocks, safe to call from any thread.
+     * @return @c false if the message was dropped since the ring buffer is full.
+     */
+    bool log(const QString &message);
+    /**
+     * Waits until all messages logged so far by this thread are written and flushed.
+     */
+    void flush();
+    /**
+     * @return @c true if `flush` waits for the writer thread, i.e. the logger is open and this is not the writer
+     * thread.
+     */
+    bool canFlush() const;
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        QString message;
+    };
+
+    bool push(const QString &message);
+    bool pop(QString &message);
+    void run();
+    void write(const QByteArray &data);
+    void rotate();
+
+    static constexpr size_t Capacity = 16384; // messages, must be a power of 2
+    std::unique_ptr<Slot[]> m_slots;
+    alignas(64) std::atomic<size_t> m_enqueuePos{0};
+    alignas(64) size_t m_dequeuePos = 0; // only touched by the writer thread
+    std::atomic<quint64> m_dropped{0};
+
+    qint64 m_maxFileSize;
+    int m_maxBackups;
+    QFile m_file; // only touched by the writer thread while it runs
+    std::thread m_thread;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeUp;  // wakes the writer up
+    std::condition_variable m_flushed; // wakes up threads waiting in `flush`
+    std::atomic<bool> m_sleeping{false};
+    std::atomic<bool> m_stopping{false};
+    std::atomic<quint64> m_flushRequests{0};
+    quint64 m_flushedRequests = 0; // guarded by `m_mutex`
+    bool m_finished = false;       // ditto, the writer thread has finished
+};
+
+#endif // ASYNCLOGGER_H
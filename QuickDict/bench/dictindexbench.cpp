@@ -0,0 +1,320 @@
+/*
+ * Benchmarks building, saving, mapping and querying `DictIndex` with synthetic headwords.
+ *
+ * Every case prints one JSON object per line to stdout (or to --output), progress goes to stderr. Peak RSS is the
+ * peak of the whole process so far, run a single case per process to measure it alone, e.g.
+ *
+ *     quickdict_bench --scripts cjk --sizes 5000000
+ */
+
+#include "dictindex.h"
+#include "utils.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+
+#include <chrono>
+#include <map>
+#include <random>
+
+#if defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#elif defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#endif
+
+using BenchKey = QString;
+using BenchEntry = std::tuple<uint64_t, uint64_t, uint64_t>; // same as MdxEntry
+using BenchIndex = DictIndex<BenchKey, BenchEntry>;
+
+/**
+ * Generates random headwords of a script, with letters as frequent as in real words so that keys share prefixes.
+ */
+class KeyGenerator
+{
+public:
+    KeyGenerator(const QString &script, unsigned seed)
+        : m_script(script)
+        , m_rng(seed)
+    {
+        // English letter frequencies in per mille, 'a' to 'z'
+        static const double weights[] = {82, 15, 28, 43, 127, 22, 20, 61, 70, 2, 8, 40, 24,
+                                         67, 75, 19, 1,  60, 63, 91, 28, 10, 24, 2,  20, 1};
+        m_letters = std::discrete_distribution<int>(std::begin(weights), std::end(weights));
+        // àáâäå ç èéêë ìíîï ñ òóôöø ùúûü ýÿ
+        m_accents = {{'a', QStringLiteral("\u00e0\u00e1\u00e2\u00e4\u00e5")},
+                     {'c', QStringLiteral("\u00e7")},
+                     {'e', QStringLiteral("\u00e8\u00e9\u00ea\u00eb")},
+                     {'i', QStringLiteral("\u00ec\u00ed\u00ee\u00ef")},
+                     {'n', QStringLiteral("\u00f1")},
+                     {'o', QStringLiteral("\u00f2\u00f3\u00f4\u00f6\u00f8")},
+                     {'u', QStringLiteral("\u00f9\u00fa\u00fb\u00fc")},
+                     {'y', QStringLiteral("\u00fd\u00ff")}};
+    }
+
+    inline bool isValid() const { return m_script == "ascii" || m_script == "latin" || m_script == "cjk"; }
+
+    QString next()
+    {
+        QString key;
+        if (m_script == "cjk") {
+            // mostly two characters, from the 6000 most common ones of the CJK Unified Ideographs block
+            static const double lengths[] = {0, 20, 50, 15, 15};
+            std::discrete_distribution<int> length(std::begin(lengths), std::end(lengths));
+            std::uniform_int_distribution<int> character(0x4E00, 0x4E00 + 6000 - 1);
+            for (int i = length(m_rng); i > 0; --i)
+                key.append(QChar(character(m_rng)));
+        } else {
+            std::uniform_int_distribution<int> length(2, 14);
+            std::uniform_int_distribution<int> percent(0, 99);
+            for (int i = length(m_rng); i > 0; --i) {
+                char letter = 'a' + m_letters(m_rng);
+                auto it = m_accents.find(letter);
+                if (m_script == "latin" && it != m_accents.end() && percent(m_rng) < 15) {
+                    std::uniform_int_distribution<int> accent(0, it->second.size() - 1);
+                    key.append(it->second.at(accent(m_rng)));
+                } else {
+                    key.append(QLatin1Char(letter));
+                }
+            }
+        }
+        return key;
+    }
+
+    /**
+     * @return @p count distinct keys in ascending order.
+     */
+    std::vector<QString> sortedKeys(size_t count)
+    {
+        std::vector<QString> keys;
+        keys.reserve(count);
+        while (keys.size() < count) {
+            for (size_t i = keys.size(); i < count; ++i)
+                keys.push_back(next());
+            std::sort(keys.begin(), keys.end());
+            keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        }
+        return keys;
+    }
+
+private:
+    QString m_script;
+    std::mt19937 m_rng;
+    std::discrete_distribution<int> m_letters;
+    std::map<char, QString> m_accents;
+};
+
+/**
+ * @return peak resident set size of the process in KiB, -1 if unknown.
+ */
+static qint64 peakRssKiB()
+{
+#if defined(Q_OS_MACOS)
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss / 1024 : -1; // in bytes
+#elif defined(Q_OS_UNIX)
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : -1;
+#elif defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize / 1024;
+    return -1;
+#else
+    return -1;
+#endif
+}
+
+/**
+ * @return mean and percentiles of @p samples in ns.
+ */
+static QJsonObject latencies(std::vector<qint64> &samples)
+{
+    QJsonObject o;
+    o["count"] = static_cast<qint64>(samples.size());
+    if (samples.empty())
+        return o;
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](double p) {
+        return samples[std::min(samples.size() - 1, static_cast<size_t>(p * samples.size()))];
+    };
+    double sum = 0;
+    for (qint64 sample : samples)
+        sum += sample;
+    o["meanNs"] = sum / samples.size();
+    o["p50Ns"] = percentile(0.5);
+    o["p90Ns"] = percentile(0.9);
+    o["p99Ns"] = percentile(0.99);
+    o["p999Ns"] = percentile(0.999);
+    o["maxNs"] = samples.back();
+    return o;
+}
+
+/**
+ * Times `findEntry` for each of @p queries.
+ * @return latencies, and how many queries were found.
+ */
+static QJsonObject benchFindEntry(const BenchIndex &index, const std::vector<QString> &queries)
+{
+    using Clock = std::chrono::steady_clock;
+    std::vector<qint64> samples;
+    samples.reserve(queries.size());
+    qint64 found = 0;
+    for (const QString &query : queries) {
+        Clock::time_point begin = Clock::now();
+        std::vector<BenchEntry> values = index.findEntry(query);
+        Clock::time_point end = Clock::now();
+        samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+        found += !values.empty();
+    }
+    QJsonObject o = latencies(samples);
+    o["found"] = found;
+    return o;
+}
+
+static QJsonObject benchCase(const QString &script, size_t count, int lookups, unsigned seed)
+{
+    QJsonObject o{{"bench", "dictindex"},
+                  {"version", QUICKDICT_VERSION},
+                  {"script", script},
+                  {"seed", static_cast<qint64>(seed)}};
+    QElapsedTimer timer;
+
+    KeyGenerator generator(script, seed);
+    timer.start();
+    std::vector<QString> keys = generator.sortedKeys(count);
+    o["keys"] = static_cast<qint64>(keys.size());
+    o["generateMs"] = timer.nsecsElapsed() / 1e6;
+
+    // build
+    BenchIndex index;
+    timer.restart();
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (!index.addEntry(keys[i], BenchEntry(i / 64, i % 64 * 512, 512))) {
+            o["error"] = "addEntry failed";
+            return o;
+        }
+    }
+    qint64 addNs = timer.nsecsElapsed();
+    timer.restart();
+    index.finish();
+    qint64 finishNs = timer.nsecsElapsed();
+    o["build"] = QJsonObject{{"addEntryMs", addNs / 1e6},
+                             {"keysPerSec", addNs > 0 ? keys.size() * 1e9 / addNs : 0.0},
+                             {"finishMs", finishNs / 1e6},
+                             {"trieNodes", static_cast<qint64>(index.trieNodeCount())},
+                             {"nodes", static_cast<qint64>(index.nodeCount())}};
+
+    // serialize and map
+    QTemporaryDir dir;
+    QString fileName = dir.filePath("bench.index");
+    FILE *indexFile = dir.isValid() ? fopen_unicode(fileName.toStdString().c_str(), "wb+") : nullptr;
+    if (nullptr == indexFile) {
+        o["error"] = "failed to open " + fileName;
+        return o;
+    }
+    timer.restart();
+    size_t bytes = index.serialize(indexFile);
+    fclose(indexFile);
+    o["serialize"] = QJsonObject{{"ms", timer.nsecsElapsed() / 1e6},
+                                 {"bytes", static_cast<qint64>(bytes)},
+                                 {"bytesPerKey", keys.empty() ? 0.0 : double(bytes) / keys.size()}};
+    BenchIndex mapped;
+    timer.restart();
+    bool ok = mapped.map(fileName);
+    o["deserialize"] = QJsonObject{{"ms", timer.nsecsElapsed() / 1e6}, {"mapped", ok}};
+    if (!ok) {
+        o["error"] = "failed to map " + fileName;
+        return o;
+    }
+
+    // lookups of existing keys and of keys which aren't there, both on the mapped index
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<size_t> pick(0, keys.size() - 1);
+    std::vector<QString> hits;
+    std::vector<QString> misses;
+    hits.reserve(lookups);
+    misses.reserve(lookups);
+    for (int i = 0; i < lookups; ++i)
+        hits.push_back(keys[pick(rng)]);
+    for (int tries = 0; misses.size() < size_t(lookups) && tries < 100 * lookups; ++tries) {
+        QString key = generator.next();
+        if (!std::binary_search(keys.begin(), keys.end(), key))
+            misses.push_back(key);
+    }
+    o["findEntry"] = QJsonObject{{"hit", benchFindEntry(mapped, hits)}, {"miss", benchFindEntry(mapped, misses)}};
+
+    o["peakRssKiB"] = peakRssKiB();
+    return o;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("quickdict_bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmarks DictIndex with synthetic headwords.");
+    parser.addHelpOption();
+    QCommandLineOption scriptsOption("scripts", "Comma separated scripts: ascii, latin, cjk.", "scripts",
+                                     "ascii,latin,cjk");
+    QCommandLineOption sizesOption("sizes", "Comma separated numbers of keys.", "sizes",
+                                   "10000,100000,1000000,5000000");
+    QCommandLineOption lookupsOption("lookups", "Number of hits and of misses looked up.", "count", "100000");
+    QCommandLineOption seedOption("seed", "Seed of the key generator.", "seed", "1");
+    QCommandLineOption outputOption("output", "Appends results to <file> instead of stdout.", "file");
+    parser.addOptions({scriptsOption, sizesOption, lookupsOption, seedOption, outputOption});
+    parser.process(app);
+
+    const QStringList scripts = parser.value(scriptsOption).split(',', Qt::SkipEmptyParts);
+    QList<size_t> sizes;
+    for (const QString &size : parser.value(sizesOption).split(',', Qt::SkipEmptyParts)) {
+        bool ok = false;
+        sizes.append(size.toULongLong(&ok));
+        if (!ok || sizes.last() == 0) {
+            qCritical() << "Invalid size:" << size;
+            return 1;
+        }
+    }
+    int lookups = parser.value(lookupsOption).toInt();
+    unsigned seed = parser.value(seedOption).toUInt();
+    for (const QString &script : scripts) {
+        if (!KeyGenerator(script, seed).isValid()) {
+            qCritical() << "Invalid script:" << script;
+            return 1;
+        }
+    }
+
+    QFile output;
+    bool opened;
+    if (parser.isSet(outputOption)) {
+        output.setFileName(parser.value(outputOption));
+        opened = output.open(QIODevice::Append);
+    } else {
+        opened = output.open(stdout, QIODevice::WriteOnly);
+    }
+    if (!opened) {
+        qCritical() << "Failed to open" << parser.value(outputOption);
+        return 1;
+    }
+
+    int failures = 0;
+    for (const QString &script : scripts) {
+        for (size_t size : qAsConst(sizes)) {
+            qInfo() << "Bench:" << script << size << "keys";
+            QJsonObject result = benchCase(script, size, lookups, seed);
+            if (result.contains("error")) {
+                qWarning() << "Bench:" << script << size << "error:" << result.value("error").toString();
+                ++failures;
+            }
+            output.write(QJsonDocument(result).toJson(QJsonDocument::Compact) + '\n');
+            output.flush();
+        }
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * Benchmarks handing a screenshot over to Tesseract: encoding it to PNG and decoding it with Leptonica, as OcrWorker
+ * used to, against passing its pixels directly with `OcrWorker::setImage`.
+ *
+ * Screenshots are rendered with text, so it needs a platform plugin, e.g.
+ *
+ *     quickdict_ocr_bench -platform offscreen --tessdata /usr/share/tessdata
+ */
+
+#include "ocrworker.h"
+
+#include <leptonica/allheaders.h>
+#include <tesseract/baseapi.h>
+#include <QBuffer>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QGuiApplication>
+#include <QImage>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QPainter>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+/**
+ * @return an image looking like a page of text on a screen of @p size.
+ */
+static QImage makeScreenshot(const QSize &size)
+{
+    QImage image(size, QImage::Format_RGB32);
+    image.fill(Qt::white);
+    QPainter painter(&image);
+    QFont font = painter.font();
+    font.setPixelSize(16);
+    painter.setFont(font);
+    painter.fillRect(0, 0, size.width(), 32, QColor(0x30, 0x30, 0x38)); // title bar
+    const QString line = "The quick brown fox jumps over the lazy dog while QuickDict looks up every word.";
+    const int lineHeight = 24;
+    int row = 0;
+    for (int y = 64; y + lineHeight < size.height(); y += lineHeight, ++row) {
+        painter.setPen(row % 7 == 0 ? QColor(0x20, 0x50, 0xc0) : Qt::black);
+        for (int x = 16; x < size.width(); x += 760)
+            painter.drawText(x, y, line);
+    }
+    return image;
+}
+
+static void setImagePng(tesseract::TessBaseAPI *tessApi, const QImage &image)
+{
+    QByteArray bytes;
+    QBuffer buf(&bytes);
+    buf.open(QIODevice::WriteOnly);
+    image.save(&buf, "PNG");
+
+    Pix *img = pixReadMemPng((l_uint8 *) bytes.constData(), bytes.size());
+    tessApi->SetImage(img);
+    pixDestroy(&img);
+}
+
+/**
+ * Runs @p setImage @p iterations times on @p image.
+ * @return timings in ms, and the number of words Tesseract finds in the result, which should be the same for every
+ * path.
+ */
+static QJsonObject benchPath(tesseract::TessBaseAPI *tessApi,
+                             const QImage &image,
+                             int iterations,
+                             const std::function<void(tesseract::TessBaseAPI *, const QImage &)> &setImage)
+{
+    std::vector<double> samples;
+    QElapsedTimer timer;
+    for (int i = 0; i < iterations; ++i) {
+        timer.start();
+        setImage(tessApi, image);
+        samples.push_back(timer.nsecsElapsed() / 1e6);
+        tessApi->Clear();
+    }
+    std::sort(samples.begin(), samples.end());
+    double sum = 0;
+    for (double sample : samples)
+        sum += sample;
+
+    setImage(tessApi, image);
+    Boxa *boxa = tessApi->GetWords(nullptr);
+    int words = boxa ? boxaGetCount(boxa) : 0;
+    boxaDestroy(&boxa);
+    tessApi->Clear();
+
+    return QJsonObject{{"iterations", iterations},
+                       {"meanMs", sum / samples.size()},
+                       {"medianMs", samples[samples.size() / 2]},
+                       {"minMs", samples.front()},
+                       {"maxMs", samples.back()},
+                       {"words", words}};
+}
+
+int main(int argc, char *argv[])
+{
+    QGuiApplication app(argc, argv);
+    QCoreApplication::setApplicationName("quickdict_ocr_bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmarks passing screenshots to Tesseract.");
+    parser.addHelpOption();
+    QCommandLineOption tessdataOption("tessdata", "Tesseract data directory.", "dir", "/usr/share/tessdata");
+    QCommandLineOption langOption("lang", "Tesseract language.", "lang", "eng");
+    QCommandLineOption iterationsOption("iterations", "Runs of each path per size.", "count", "20");
+    QCommandLineOption outputOption("output", "Appends results to <file> instead of stdout.", "file");
+    parser.addOptions({tessdataOption, langOption, iterationsOption, outputOption});
+    parser.process(app);
+
+    tesseract::TessBaseAPI tessApi;
+    QString tessdata = parser.value(tessdataOption);
+    if (tessApi.Init(tessdata.toStdString().c_str(), parser.value(langOption).toStdString().c_str())) {
+        qCritical() << "Could not initialize tesseract.";
+        return 1;
+    }
+    int iterations = std::max(1, parser.value(iterationsOption).toInt());
+
+    QFile output;
+    bool opened;
+    if (parser.isSet(outputOption)) {
+        output.setFileName(parser.value(outputOption));
+        opened = output.open(QIODevice::Append);
+    } else {
+        opened = output.open(stdout, QIODevice::WriteOnly);
+    }
+    if (!opened) {
+        qCritical() << "Failed to open" << parser.value(outputOption);
+        return 1;
+    }
+
+    const QList<QPair<QString, QSize>> sizes{{"1080p", QSize(1920, 1080)}, {"4k", QSize(3840, 2160)}};
+    for (const auto &size : sizes) {
+        qInfo() << "Bench:" << size.first;
+        QImage screenshot = makeScreenshot(size.second);
+        QJsonObject result{{"bench", "ocr-setimage"},
+                           {"version", QUICKDICT_VERSION},
+                           {"screen", size.first},
+                           {"width", size.second.width()},
+                           {"height", size.second.height()},
+                           {"png", benchPath(&tessApi, screenshot, iterations, setImagePng)},
+                           {"raw", benchPath(&tessApi, screenshot, iterations, OcrWorker::setImage)}};
+        output.write(QJsonDocument(result).toJson(QJsonDocument::Compact) + '\n');
+        output.flush();
+    }
+    tessApi.End();
+    return 0;
+}
@@ -2,57 +2,135 @@
 #include "quickdict.h"
 #include <QCoreApplication>
 #include <QMutexLocker>
+#include <algorithm>
+#include <chrono>
 
 ConfigCenter::ConfigCenter(const QString &fileName, QSettings::Format format, QObject *parent)
     : QObject(parent)
     , m_config(fileName, format)
-{}
+    , m_fileName(fileName)
+    , m_format(format)
+{
+    Values values;
+    const QStringList keys = m_config.allKeys();
+    for (const QString &key : keys)
+        values.insert(key, m_config.value(key));
+    m_values = std::make_shared<const Values>(std::move(values));
+    m_thread = std::thread(&ConfigCenter::run, this);
+    // the destructor writes them too, but it may run long after the event loop has ended
+    if (QCoreApplication *app = QCoreApplication::instance())
+        connect(app, &QCoreApplication::aboutToQuit, this, &ConfigCenter::flush);
+}
 
-ConfigCenter::~ConfigCenter() {}
+ConfigCenter::~ConfigCenter()
+{
+    {
+        std::lock_guard<std::mutex> locker(m_pendingMutex);
+        m_stopping = true;
+    }
+    m_wakeUp.notify_one();
+    m_thread.join();
+}
 
 QVariant ConfigCenter::value(const QString &key, const QVariant &defaultValue, bool store)
 {
-    QMutexLocker locker(&m_mutex);
-    QStringList groupSplit = m_config.group().split("/", Qt::SkipEmptyParts);
-    if (key.startsWith('/') && !m_config.group().isEmpty()) {
-        for (const auto &_ : qAsConst(groupSplit)) {
-            Q_UNUSED(_)
-            m_config.endGroup();
-        }
-    }
-    QVariant v = m_config.value(key, defaultValue);
-    if (!m_config.contains(key) && store) {
-        m_config.setValue(key, defaultValue);
-        m_config.sync();
-        QString absoluteKey = "/" + (groupSplit + key.split("/", Qt::SkipEmptyParts)).join('/');
-        emit valueChanged(absoluteKey, defaultValue);
-    }
-    if (key.startsWith('/') && !m_config.group().isEmpty()) {
-        for (const auto &group : qAsConst(groupSplit))
-            m_config.beginGroup(group);
-    }
-    return v;
+    std::shared_ptr<const Values> values = std::atomic_load(&m_values);
+    auto it = values->constFind(absoluteKey(key));
+    if (it != values->constEnd())
+        return it.value();
+    if (store)
+        setValue(key, defaultValue);
+    return defaultValue;
 }
 
 void ConfigCenter::setValue(const QString &key, const QVariant &value)
 {
-    QMutexLocker locker(&m_mutex);
-    QStringList groupSplit = m_config.group().split("/", Qt::SkipEmptyParts);
-    if (key.startsWith('/') && !m_config.group().isEmpty()) {
-        for (const auto &_ : qAsConst(groupSplit)) {
-            Q_UNUSED(_)
-            m_config.endGroup();
-        }
+    QString absolute = absoluteKey(key);
+    {
+        QMutexLocker locker(&m_mutex);
+        std::shared_ptr<const Values> values = std::atomic_load(&m_values);
+        auto it = values->constFind(absolute);
+        if (it != values->constEnd() && it.value() == value)
+            return;
+        std::shared_ptr<Values> updated = std::make_shared<Values>(*values);
+        updated->insert(absolute, value);
+        std::atomic_store(&m_values, std::shared_ptr<const Values>(std::move(updated)));
+
+        std::lock_guard<std::mutex> pendingLocker(m_pendingMutex);
+        m_pending.insert(absolute, value);
+        ++m_changes;
     }
-    if (m_config.value(key) != value) {
-        m_config.setValue(key, value);
-        m_config.sync();
-        QString absoluteKey = "/" + (groupSplit + key.split("/", Qt::SkipEmptyParts)).join('/');
-        qCDebug(qd) << "Config" << absoluteKey << ":" << value;
-        emit valueChanged(absoluteKey, value);
-        if (key.startsWith('/') && !m_config.group().isEmpty()) {
-            for (const auto &group : qAsConst(groupSplit))
-                m_config.beginGroup(group);
+    m_wakeUp.notify_one();
+
+    qCDebug(qd) << "Config" << "/" + absolute << ":" << value;
+    emit valueChanged("/" + absolute, value);
+}
+
+void ConfigCenter::flush()
+{
+    std::unique_lock<std::mutex> locker(m_pendingMutex);
+    quint64 changes = m_changes;
+    if (m_writtenChanges >= changes)
+        return;
+    m_flushRequested = true;
+    m_wakeUp.notify_one();
+    m_written.wait(locker, [this, changes]() { return m_writtenChanges >= changes; });
+}
+
+QString ConfigCenter::absoluteKey(const QString &key) const
+{
+    QStringList parts = key.split('/', Qt::SkipEmptyParts);
+    if (!key.startsWith('/'))
+        parts = m_config.group().split('/', Qt::SkipEmptyParts) + parts;
+    return parts.join('/');
+}
+
+void ConfigCenter::run()
+{
+    using Clock = std::chrono::steady_clock;
+    std::unique_lock<std::mutex> locker(m_pendingMutex);
+    for (;;) {
+        m_wakeUp.wait(locker, [this]() { return !m_pending.isEmpty() || m_flushRequested || m_stopping; });
+
+        // waits for changes to stop coming in, e.g. while a slider is dragged, but not forever
+        Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(MaxWriteDelay);
+        while (!m_flushRequested && !m_stopping) {
+            quint64 changes = m_changes;
+            Clock::time_point wakeUp = std::min(deadline, Clock::now() + std::chrono::milliseconds(WriteDelay));
+            m_wakeUp.wait_until(locker, wakeUp, [this, changes]() {
+                return m_flushRequested || m_stopping || m_changes != changes;
+            });
+            if (m_changes == changes || Clock::now() >= deadline)
+                break;
         }
+
+        Values pending;
+        pending.swap(m_pending);
+        quint64 changes = m_changes;
+        bool stopping = m_stopping;
+        m_flushRequested = false;
+        locker.unlock();
+        if (!pending.isEmpty())
+            write(pending);
+        locker.lock();
+        m_writtenChanges = changes;
+        m_written.notify_all();
+        if (stopping && m_pending.isEmpty())
+            break;
     }
 }
+
+void ConfigCenter::write(const Values &changes)
+{
+    // QSettings objects of the same file share their contents within a process, `m_config` sees these changes
+    QSettings settings(m_fileName, m_format);
+    // written to a temporary file which then replaces the old one, a crash never leaves a truncated file behind
+    settings.setAtomicSyncRequired(true);
+    for (auto it = changes.constBegin(); it != changes.constEnd(); ++it)
+        settings.setValue(it.key(), it.value());
+    settings.sync();
+    if (settings.status() != QSettings::NoError)
+        qCWarning(qd) << "Config: failed to write" << m_fileName << settings.status();
+    else
+        qCDebug(qd) << "Config: wrote" << changes.size() << "changes to" << m_fileName;
+}
@@ -1,9 +1,22 @@
 #ifndef CONFIGCENTER_H
 #define CONFIGCENTER_H
 
+#include <QHash>
 #include <QMutex>
 #include <QSettings>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 
+/**
+ * ConfigCenter keeps the configuration in memory and writes changes to its file behind the scenes.
+ *
+ * Reads go to an immutable snapshot of all values, which writers replace by an updated copy, so they never wait for a
+ * writer or the disk. Changes are collected and written by a background thread once no more arrive for
+ * `WriteDelay` ms, or at the latest `MaxWriteDelay` ms after the first one, replacing the file atomically. They are
+ * also written when the ConfigCenter is destroyed, or at once by `flush`.
+ */
 class ConfigCenter : public QObject
 {
     Q_OBJECT
@@ -13,6 +26,9 @@ public:
                           QObject *parent = nullptr);
     ~ConfigCenter();
 
+    /**
+     * Direct access to the file, only from the thread of the ConfigCenter. Values written here bypass the snapshot.
+     */
     inline QSettings *settings() { return &m_config; }
     /**
      * @param key a key starts with '/' means it is absolute in group.
@@ -23,13 +39,40 @@ public:
      * @param key a key starts with '/' means it is absolute in group.
      */
     Q_INVOKABLE void setValue(const QString &key, const QVariant &value);
+    /**
+     * Writes pending changes now and waits until they are on disk.
+     */
+    Q_INVOKABLE void flush();
 
 Q_SIGNALS:
     void valueChanged(const QString &key, const QVariant &value);
 
 private:
+    using Values = QHash<QString, QVariant>; // by absolute key without the leading '/'
+
+    /** @return @p key with the group of `settings` prepended unless it is absolute, without the leading '/'. */
+    QString absoluteKey(const QString &key) const;
+    void run();
+    void write(const Values &changes);
+
+    static constexpr int WriteDelay = 500;
+    static constexpr int MaxWriteDelay = 5000;
+
     QSettings m_config;
-    QMutex m_mutex;
+    const QString m_fileName;
+    const QSettings::Format m_format;
+    std::shared_ptr<const Values> m_values; // accessed with `std::atomic_load` and `std::atomic_store`
+    QMutex m_mutex;                         // serializes writers of `m_values`
+
+    std::thread m_thread;
+    std::mutex m_pendingMutex;
+    std::condition_variable m_wakeUp;  // wakes the writer thread up
+    std::condition_variable m_written; // wakes up threads waiting in `flush`
+    Values m_pending;                  // guarded by `m_pendingMutex`, as are the following
+    quint64 m_changes = 0;             // number of changes so far
+    quint64 m_writtenChanges = 0;      // ditto, written to the file
+    bool m_flushRequested = false;
+    bool m_stopping = false;
 };
 
 #endif // CONFIGCENTER_H
@@ -0,0 +1,268 @@
+#include "dictdfiledict.h"
+#include "quickdict.h"
+#include "trace.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+/**
+ * @return the number written in the base64 digits from @p p to @p end, most significant first, -1 if a digit is
+ * invalid.
+ */
+qint64 decodeBase64Number(const char *p, const char *end)
+{
+    if (p == end)
+        return -1;
+    qint64 number = 0;
+    for (; p < end; ++p) {
+        int digit;
+        if (*p >= 'A' && *p <= 'Z')
+            digit = *p - 'A';
+        else if (*p >= 'a' && *p <= 'z')
+            digit = *p - 'a' + 26;
+        else if (*p >= '0' && *p <= '9')
+            digit = *p - '0' + 52;
+        else if (*p == '+')
+            digit = 62;
+        else if (*p == '/')
+            digit = 63;
+        else
+            return -1;
+        number = number * 64 + digit;
+    }
+    return number;
+}
+
+// entries of dictfmt telling that the database is in UTF-8, spelled differently by its versions
+const char *const Utf8Keys[] = {"00-database-utf8", "00databaseutf8"};
+
+} // namespace
+
+DictdFileDict::DictdFileDict(QObject *parent)
+    : LocalDict(parent)
+{
+    m_dictIndex = new DictdIndex;
+}
+
+DictdFileDict::~DictdFileDict()
+{
+    shutdown();
+    delete m_dictIndex;
+}
+
+void DictdFileDict::setChunkCacheSize(int chunkCacheSize)
+{
+    if (chunkCacheSize == m_dictData.cacheSize())
+        return;
+    m_dictData.setCacheSize(chunkCacheSize);
+    emit chunkCacheSizeChanged(chunkCacheSize);
+}
+
+QVariantMap DictdFileDict::chunkCacheStats() const
+{
+    return m_dictData.cacheStats();
+}
+
+bool DictdFileDict::lookupKey(const QString &key, qint64 ordinal, int queryId)
+{
+    std::vector<DictdEntry> values;
+    {
+        TraceSpan span(qdDict(), "findEntry", key);
+        values = ordinal < 0 ? m_dictIndex->findEntry(key) : m_dictIndex->valuesAt(ordinal);
+    }
+    if (values.empty())
+        return true;
+    qCDebug(qdDict) << "Dict:" << name() << "query:" << key << "count:" << values.size();
+    for (const DictdEntry &entry : values) {
+        QByteArray data = m_dictData.read(entry.first, entry.second);
+        if (data.isNull()) {
+            qCWarning(qdDict) << "Dict:" << name() << "error: Invalid definition offset" << entry.first;
+            continue;
+        }
+
+        // definitions are laid out in columns for terminals
+        QString definition = QString("<pre>%1</pre>").arg(decode(data).toHtmlEscaped());
+        QJsonObject result{
+            {"engine", name()}, {"text", key}, {"result", definition}, {"type", "lookup"}, {"id", queryId}};
+        emit queryResult(result);
+    }
+
+    return true;
+}
+
+void DictdFileDict::forEachKey(const std::function<bool(const QString &, quint32)> &visit) const
+{
+    m_dictIndex->forEachKey([&visit](const DictdKey &key, size_t ordinal) { return visit(key, ordinal); });
+}
+
+QStringList DictdFileDict::findPrefix(const QString &prefix, int limit) const
+{
+    QStringList l;
+    for (const DictdKey &key : m_dictIndex->findPrefix(prefix, limit))
+        l.append(key);
+    return l;
+}
+
+bool DictdFileDict::containsKey(const QString &key) const
+{
+    return m_dictIndex->contains(key);
+}
+
+QStringList DictdFileDict::findFuzzy(const QString &key, int maxDistance, int limit) const
+{
+    QStringList l;
+    for (const auto &match : m_dictIndex->findFuzzy(key, maxDistance, limit))
+        l.append(match.first);
+    return l;
+}
+
+QString DictdFileDict::decode(const QByteArray &data) const
+{
+    return m_utf8 ? QString::fromUtf8(data) : QString::fromLatin1(data);
+}
+
+void DictdFileDict::readDatabaseInfo()
+{
+    m_utf8 = false;
+    for (const char *key : Utf8Keys) {
+        if (!m_dictIndex->findEntry(QuickDict::instance()->normalizeKey(std::string(key))).empty())
+            m_utf8 = true;
+    }
+    std::vector<DictdEntry> values = m_dictIndex->findEntry(
+        QuickDict::instance()->normalizeKey(std::string("00-database-short")));
+    if (!values.empty()) {
+        // the first line is the headword itself
+        QString info = decode(m_dictData.read(values.front().first, values.front().second));
+        qCDebug(qdDict) << "Dict:" << name() << "database:" << info.section('\n', 1).simplified()
+                        << "utf8:" << m_utf8;
+    }
+}
+
+bool DictdFileDict::loadDict()
+{
+    QFileInfo indexFileInfo(m_dictFileName);
+    QString baseName = indexFileInfo.dir().filePath(indexFileInfo.completeBaseName());
+    QString dictFileName;
+    for (const char *suffix : {".dict.dz", ".dict"}) {
+        if (QFileInfo::exists(baseName + suffix)) {
+            dictFileName = baseName + suffix;
+            break;
+        }
+    }
+    if (dictFileName.isEmpty()) {
+        qCWarning(qdDict) << "Dict:" << name() << "error: No .dict.dz or .dict file next to" << m_dictFileName;
+        return false;
+    }
+    if (!m_dictData.open(dictFileName)) {
+        qCWarning(qdDict) << "Dict:" << name() << "error:" << m_dictData.errorString();
+        return false;
+    }
+    qCDebug(qdDict) << "Dict:" << name() << "compressed:" << m_dictData.isCompressed();
+
+    return true;
+}
+
+bool DictdFileDict::unloadDict()
+{
+    m_dictData.close();
+    return true;
+}
+
+bool DictdFileDict::buildIndex()
+{
+    qCDebug(qdDict) << "Dict:" << name() << "status: Building indexes...";
+
+    QFile indexFile(m_dictFileName);
+    if (!indexFile.open(QIODevice::ReadOnly)) {
+        qCWarning(qdDict) << "Dict:" << name() << "error: Failed to open file" << m_dictFileName;
+        return false;
+    }
+    const QByteArray index = indexFile.readAll();
+    indexFile.close();
+
+    // lines of "headword\toffset\tsize", newer versions of dictfmt may append "\toriginal headword"
+    std::vector<std::pair<QByteArray, DictdEntry>> words;
+    bool utf8 = false;
+    int invalid = 0;
+    for (const char *p = index.constData(), *end = p + index.size(); p < end;) {
+        const char *lineEnd = static_cast<const char *>(memchr(p, '\n', end - p));
+        if (!lineEnd)
+            lineEnd = end;
+        const char *tab1 = static_cast<const char *>(memchr(p, '\t', lineEnd - p));
+        const char *tab2 = tab1 ? static_cast<const char *>(memchr(tab1 + 1, '\t', lineEnd - tab1 - 1)) : nullptr;
+        const char *tab3 = tab2 ? static_cast<const char *>(memchr(tab2 + 1, '\t', lineEnd - tab2 - 1)) : nullptr;
+        qint64 offset = tab2 ? decodeBase64Number(tab1 + 1, tab2) : -1;
+        qint64 size = tab2 ? decodeBase64Number(tab2 + 1, tab3 ? tab3 : lineEnd) : -1;
+        if (offset >= 0 && size >= 0 && size <= std::numeric_limits<uint32_t>::max()) {
+            QByteArray word(p, tab1 - p);
+            for (const char *key : Utf8Keys)
+                utf8 = utf8 || word == key;
+            words.emplace_back(word, DictdEntry(offset, size));
+        } else if (lineEnd > p) {
+            ++invalid;
+        }
+        p = lineEnd + 1;
+    }
+    if (invalid)
+        qCWarning(qdDict) << "Dict:" << name() << "error:" << invalid << "invalid lines in" << m_dictFileName;
+    reportProgress(0.3);
+
+    bool needSort = !sorted();
+#if defined(ENABLE_OPENCC) || defined(ENABLE_UNAC)
+    needSort = true;
+#endif
+    auto make = [&words, utf8](size_t i, DictdKey &key, DictdEntry &entry) {
+        const QByteArray &word = words[i].first;
+        key = utf8 ? QuickDict::instance()->normalizeKey(word.toStdString())
+                   : QuickDict::instance()->normalizeKey(QString::fromLatin1(word));
+        entry = words[i].second;
+    };
+    auto entries = makeEntries<DictdKey, DictdEntry>(words.size(), needSort, make);
+    words = decltype(words)();
+    reportProgress(0.5);
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (!m_dictIndex->addEntry(entries[i].first, entries[i].second)) {
+            qCWarning(qdDict) << "Dict:" << name() << "error: Failed to build indexes";
+            m_dictIndex->clear();
+            return false;
+        }
+        if (i % 65536 == 0)
+            reportProgress(0.5 + 0.4 * i / entries.size());
+    }
+    entries = decltype(entries)();
+
+    qCDebug(qdDict) << "Dict:" << name() << "status: Minimizing indexes...";
+    m_dictIndex->finish();
+    reportProgress(0.95);
+    qCInfo(qdDict) << "Dict:" << name() << "keys:" << m_dictIndex->keyCount()
+                   << "nodes:" << m_dictIndex->trieNodeCount() << "->" << m_dictIndex->nodeCount();
+    readDatabaseInfo();
+
+    // without a saved index, the one in memory still serves until the next start
+    saveIndex(m_dictIndex);
+    return true;
+}
+
+bool DictdFileDict::loadIndex()
+{
+    qCDebug(qdDict) << "Dict:" << name() << "status: Loading indexes...";
+
+    if (!m_dictIndex->map(m_indexFileName)) {
+        qCWarning(qdDict) << "Dict:" << name() << "error: Failed to map index file" << m_indexFileName;
+        return false;
+    }
+    qCDebug(qdDict) << "Dict:" << name() << "keys:" << m_dictIndex->keyCount() << "bytes:" << m_dictIndex->byteCount();
+    readDatabaseInfo();
+
+    return true;
+}
+
+bool DictdFileDict::unloadIndex()
+{
+    m_dictIndex->clear();
+    return true;
+}
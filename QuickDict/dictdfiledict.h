@@ -0,0 +1,69 @@
+#ifndef DICTDFILEDICT_H
+#define DICTDFILEDICT_H
+
+#include "dictindex.h"
+#include "dictzipfile.h"
+#include "localdict.h"
+#include <QVariantMap>
+
+using DictdKey = QString;
+using DictdEntry = std::pair<uint64_t, uint32_t>; // offset and size of the definition in the .dict file
+using DictdIndex = DictIndex<DictdKey, DictdEntry>;
+
+/**
+ * DictdFileDict reads local dictd databases, the ones dict.org serves. `source` is the .index file, the .dict.dz (or
+ * .dict) file is expected next to it.
+ *
+ * Every line of the .index file holds a headword and the offset and size of its definition, both in base64 digits.
+ * Definitions are plain text read from the .dict.dz file chunk by chunk, see `DictZipFile`.
+ */
+class DictdFileDict : public LocalDict
+{
+    Q_OBJECT
+    Q_PROPERTY(int chunkCacheSize READ chunkCacheSize WRITE setChunkCacheSize NOTIFY chunkCacheSizeChanged)
+
+public:
+    explicit DictdFileDict(QObject *parent = nullptr);
+    virtual ~DictdFileDict();
+
+    /**
+     * @return maximum bytes of inflated .dict.dz chunks kept in memory.
+     */
+    inline int chunkCacheSize() const { return m_dictData.cacheSize(); }
+    void setChunkCacheSize(int chunkCacheSize);
+    /**
+     * @return hits, misses, hit rate and current usage of the chunk cache.
+     */
+    Q_INVOKABLE QVariantMap chunkCacheStats() const;
+
+    QStringList findPrefix(const QString &prefix, int limit) const override;
+    bool containsKey(const QString &key) const override;
+    QStringList findFuzzy(const QString &key, int maxDistance, int limit) const override;
+
+Q_SIGNALS:
+    void chunkCacheSizeChanged(int chunkCacheSize);
+
+protected:
+    bool lookupKey(const QString &key, qint64 ordinal, int queryId) override;
+    void forEachKey(const std::function<bool(const QString &, quint32)> &visit) const override;
+    bool loadDict() override;
+    bool unloadDict() override;
+    bool buildIndex() override;
+    bool loadIndex() override;
+    bool unloadIndex() override;
+    /**
+     * Reads the encoding and the short description of the database from its "00-database-*" entries, which are
+     * indexed like headwords.
+     */
+    void readDatabaseInfo();
+    /**
+     * @return definition @p data decoded from the encoding of the database.
+     */
+    QString decode(const QByteArray &data) const;
+
+    bool m_utf8 = false; // definitions are in Latin-1 unless the database says otherwise
+    DictZipFile m_dictData;
+    DictdIndex *m_dictIndex = nullptr;
+};
+
+#endif // DICTDFILEDICT_H
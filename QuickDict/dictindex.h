@@ -6,341 +6,847 @@
  */
 
 #include <algorithm>
-#include <stack>
+#include <new>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <tuple>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include <QFile>
 #include <QtCore/qglobal.h>
 #ifdef Q_OS_LINUX
 #include <malloc.h>
 #endif
 
-template<typename Key, typename Value>
+template<typename T>
+inline void _serialize(unsigned char *&data, const T &object)
+{
+    memcpy(data, &object, sizeof(T));
+    data += sizeof(T);
+}
+
+template<typename T>
+inline void _deserialize(const unsigned char *&data, T &object)
+{
+    memcpy(&object, data, sizeof(T));
+    data += sizeof(T);
+}
+
+template<typename T>
+inline void _serialize(unsigned char *&data, const std::vector<T> &vec)
+{
+    uint8_t size = vec.size();
+    _serialize(data, size);
+    for (int i = 0; i < size; ++i)
+        _serialize(data, vec[i]);
+}
+
+template<typename T>
+inline void _deserialize(const unsigned char *&data, std::vector<T> &vec)
+{
+    uint8_t size;
+    _deserialize(data, size);
+    vec.resize(size);
+    for (int i = 0; i < size; ++i)
+        _deserialize(data, vec[i]);
+}
+
+template<typename T1, typename T2, typename T3>
+inline void _serialize(unsigned char *&data, const std::tuple<T1, T2, T3> &t)
+{
+    _serialize(data, std::get<0>(t));
+    _serialize(data, std::get<1>(t));
+    _serialize(data, std::get<2>(t));
+}
+
+template<typename T1, typename T2, typename T3>
+inline void _deserialize(const unsigned char *&data, std::tuple<T1, T2, T3> &t)
+{
+    _deserialize(data, std::get<0>(t));
+    _deserialize(data, std::get<1>(t));
+    _deserialize(data, std::get<2>(t));
+}
+
+template<typename T1, typename T2>
+inline void _serialize(unsigned char *&data, const std::pair<T1, T2> &pair)
+{
+    _serialize(data, pair.first);
+    _serialize(data, pair.second);
+}
+
+template<typename T1, typename T2>
+inline void _deserialize(const unsigned char *&data, std::pair<T1, T2> &pair)
+{
+    _deserialize(data, pair.first);
+    _deserialize(data, pair.second);
+}
+
+/**
+ * @return the number of bytes `_serialize` writes for @p object.
+ */
+template<typename T>
+inline size_t _serializedSize(const T &object)
+{
+    unsigned char buf[sizeof(T) + sizeof(uint8_t)];
+    unsigned char *end = buf;
+    _serialize(end, object);
+    return end - buf;
+}
+
+template<typename T>
+inline size_t _hashBytes(const T &object, size_t seed)
+{
+    // FNV-1a
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(&object);
+    for (size_t i = 0; i < sizeof(T); ++i)
+        seed = (seed ^ p[i]) * 1099511628211ULL;
+    return seed;
+}
+
+/**
+ * DictIndexArena hands out memory from large chunks, which are freed all at once by `release`.
+ */
+class DictIndexArena
+{
+public:
+    explicit DictIndexArena(size_t chunkSize = 1 << 20)
+        : m_chunkSize(chunkSize)
+    {}
+    DictIndexArena(const DictIndexArena &) = delete;
+    DictIndexArena &operator=(const DictIndexArena &) = delete;
+    ~DictIndexArena() { release(); }
+
+    template<typename T>
+    T *allocate(size_t n = 1)
+    {
+        size_t offset = (m_offset + alignof(T) - 1) & ~(alignof(T) - 1);
+        size_t bytes = n * sizeof(T);
+        if (m_chunks.empty() || offset + bytes > m_capacity) {
+            m_capacity = std::max(m_chunkSize, bytes);
+            unsigned char *chunk = static_cast<unsigned char *>(malloc(m_capacity));
+            if (!chunk)
+                throw std::bad_alloc();
+            m_chunks.push_back(chunk);
+            m_byteCount += m_capacity;
+            offset = 0;
+        }
+        m_offset = offset + bytes;
+        return reinterpret_cast<T *>(m_chunks.back() + offset);
+    }
+    void release()
+    {
+        for (unsigned char *chunk : m_chunks)
+            free(chunk);
+        m_chunks.clear();
+        m_chunks.shrink_to_fit();
+        m_offset = 0;
+        m_capacity = 0;
+        m_byteCount = 0;
+    }
+    inline size_t chunkCount() const { return m_chunks.size(); }
+    inline size_t byteCount() const { return m_byteCount; }
+
+private:
+    std::vector<unsigned char *> m_chunks;
+    size_t m_chunkSize;
+    size_t m_offset = 0;   // offset of free space in the last chunk
+    size_t m_capacity = 0; // capacity of the last chunk
+    size_t m_byteCount = 0;
+};
+
+/**
+ * Nodes and their children arrays are allocated from a `DictIndexArena`, so nodes must stay trivially destructible.
+ */
+template<typename Key>
 struct DictIndexNode
 {
     using KeyIter = typename std::iterator_traits<typename Key::iterator>::value_type;
 
-    DictIndexNode(const KeyIter &key = KeyIter(), const Value &value = Value())
+    DictIndexNode(const KeyIter &key = KeyIter())
         : _key(key)
-        , _value(value)
     {}
 
-    inline void addChild(DictIndexNode *child)
-    {
-        // `_children` is in order because `addEntry` is called with ordered data.
-        _children.push_back(child);
-    }
     DictIndexNode *findChild(const KeyIter &key) const
     {
-        DictIndexNode node(key);
-        auto pos = std::lower_bound(_children.begin(), _children.end(), &node, [](const auto &lhs, const auto &rhs) {
-            return lhs->_key < rhs->_key;
+        DictIndexNode **end = _children + _childCount;
+        auto pos = std::lower_bound(_children, end, key, [](const auto &lhs, const auto &rhs) {
+            return lhs->_key < rhs;
         });
-        if (pos == _children.end() || (*pos)->_key != key)
+        if (pos == end || (*pos)->_key != key)
             return nullptr;
         return *pos;
     }
 
     KeyIter _key;
-    Value _value;
-    std::vector<DictIndexNode *> _children;
+    bool _final = false;
+    uint32_t _count = 0; // number of keys ending in this subtree, valid once the node is minimized
+    uint32_t _childCount = 0;
+    DictIndexNode **_children = nullptr; // in order because `addEntry` is called with ordered data
 };
 
-template<typename Key, typename Value>
-inline bool operator==(const DictIndexNode<Key, Value> &lhs, const DictIndexNode<Key, Value> &rhs)
+/**
+ * Two nodes are equivalent if they accept the same suffixes, i.e. they are reached by the same key, are both
+ * final or not, and point to the very same (already minimized) children.
+ */
+template<typename Key>
+inline bool operator==(const DictIndexNode<Key> &lhs, const DictIndexNode<Key> &rhs)
 {
-    return lhs._key == rhs._key && lhs._children == rhs._children;
+    return lhs._key == rhs._key && lhs._final == rhs._final && lhs._childCount == rhs._childCount
+           && std::equal(lhs._children, lhs._children + lhs._childCount, rhs._children);
 }
 
-template<typename Key, typename Value>
-struct std::hash<DictIndexNode<Key, Value>>
+template<typename Key>
+struct std::hash<DictIndexNode<Key>>
 {
-    using KeyIter = typename std::iterator_traits<typename Key::iterator>::value_type;
-    using IndexNode = DictIndexNode<Key, Value>;
-    std::size_t operator()(const IndexNode &n) const noexcept
+    std::size_t operator()(const DictIndexNode<Key> &n) const noexcept
     {
-        return std::hash<KeyIter>{}(n._key) ^ std::hash<std::vector<IndexNode *>>{}(n._children);
+        size_t seed = _hashBytes(n._key, 14695981039346656037ULL);
+        seed = _hashBytes(n._final, seed);
+        for (uint32_t i = 0; i < n._childCount; ++i)
+            seed = _hashBytes(n._children[i], seed);
+        return seed;
     }
 };
 
+/**
+ * DictIndex is a DAWG built from keys added in ascending order. Common prefixes are shared while keys are added and
+ * common suffixes are merged incrementally by `minimize`, see
+ * [Incremental Construction of Minimal Acyclic Finite-State Automata](https://aclanthology.org/J00-1002.pdf).
+ *
+ * While adding entries, the children of the unchecked nodes are collected per depth in `m_pendingChildren`. Once a
+ * node is checked, its children are copied into the arena in one go unless an equivalent node exists, in which case
+ * the node is recycled. Thus building needs only a few large allocations, and they are all released at once.
+ *
+ * Since a node may be shared by many keys, values can't live in nodes. Every node counts the keys ending in its
+ * subtree instead, so walking down a key also yields its ordinal among all keys, which indexes the values.
+ *
+ * `finish` compiles the DAWG into a flat image where children are referred to by index instead of by pointer. All
+ * lookups run on the image. The image is also the file format, so `map` queries an index file in place.
+ */
 template<typename Key, typename Value>
 class DictIndex
 {
     using KeyIter = typename std::iterator_traits<typename Key::iterator>::value_type;
-    using IndexNode = DictIndexNode<Key, std::vector<Value>>;
+    using IndexNode = DictIndexNode<Key>;
     using Size = uint32_t;
 
+    struct NodeHash
+    {
+        std::size_t operator()(const IndexNode *n) const noexcept { return std::hash<IndexNode>{}(*n); }
+    };
+    struct NodeEqual
+    {
+        bool operator()(const IndexNode *lhs, const IndexNode *rhs) const noexcept { return *lhs == *rhs; }
+    };
+
+    static constexpr uint32_t Magic = 0x32494451; // "QDI2"
+
+    /**
+     * Image layout, every section is 8-byte aligned:
+     * Header | Node nodes[nodeCount] | KeyIter edgeKeys[edgeCount] | Size edgeTargets[edgeCount]
+     * | Size edgeBases[edgeCount] | Size valueOffsets[keyCount + 1] | values[entryCount]
+     *
+     * Node 0 is the root. Edges of a node are contiguous and sorted by key. Taking an edge adds its base, i.e. the
+     * number of keys ordered before the target's subtree within the parent's subtree, to the ordinal.
+     */
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t keySize;
+        uint32_t valueSize;
+        Size nodeCount;
+        Size edgeCount;
+        Size keyCount;
+        Size entryCount;
+        uint32_t reserved;
+    };
+    struct Node
+    {
+        Size firstEdge;
+        Size info; // number of edges << 1 | final
+
+        inline Size edgeCount() const { return info >> 1; }
+        inline bool final() const { return info & 1; }
+    };
+    struct Layout
+    {
+        size_t nodes;
+        size_t edgeKeys;
+        size_t edgeTargets;
+        size_t edgeBases;
+        size_t valueOffsets;
+        size_t values;
+        size_t size;
+    };
+
 public:
-    DictIndex() { m_uncheckedNodes.push_back(&m_rootNode); };
-    IndexNode *addEntry(const Key &key, const Value &value)
+    DictIndex()
     {
-        if (key < m_prevKey)
-            return nullptr;
+        m_uncheckedNodes.push_back(&m_rootNode);
+        m_pendingChildren.emplace_back();
+    };
+    ~DictIndex() { clear(); }
+    /**
+     * Keys must be added in ascending order, and no more keys can be added after `finish`. Empty keys are ignored.
+     * @return @c true if successful, @c false otherwise.
+     */
+    bool addEntry(const Key &key, const Value &value)
+    {
+        if (m_data || key < m_prevKey)
+            return false;
 
-        IndexNode *previousNode = &m_rootNode;
         int n = key.size();
+        if (n == 0)
+            return true;
+        int m = m_prevKey.size();
         int index = 0;
-        for (; index < n; ++index) {
-            // Since it's sorted, we just need to look at the rightest child.
-            if (previousNode->_children.empty() || previousNode->_children.back()->_key != key[index])
-                break;
-            previousNode = previousNode->_children.back();
+        while (index < n && index < m && key[index] == m_prevKey[index])
+            ++index;
+        if (index == n && index == m) {
+            // same key as the previous one
+            m_values.push_back(value);
+            ++m_entryCount;
+            return true;
         }
-        // minimize(index);
-        IndexNode *ret = previousNode;
+
+        // The path of the previous key below the common prefix won't change any more.
+        minimize(index);
         for (; index < n; ++index) {
-            IndexNode *child = new IndexNode(key[index]);
-            previousNode->addChild(child);
+            IndexNode *child = newNode(key[index]);
+            m_pendingChildren[m_uncheckedNodes.size() - 1].push_back(child);
             ++m_nodeCount;
-            previousNode = child;
-            // m_uncheckedNodes.push_back(child);
+            ++m_trieNodeCount;
+            ++m_edgeCount;
+            m_uncheckedNodes.push_back(child);
+            if (m_pendingChildren.size() < m_uncheckedNodes.size())
+                m_pendingChildren.emplace_back();
         }
-        previousNode->_value.push_back(value);
+        m_uncheckedNodes.back()->_final = true;
+        m_valueOffsets.push_back(m_values.size());
+        m_values.push_back(value);
+        ++m_keyCount;
         ++m_entryCount;
         m_prevKey = key;
-        return ret;
+        return true;
     }
-    IndexNode *findEntry(const Key &key) const
+    /**
+     * @return @c true if @p key is a key of the index.
+     */
+    bool contains(const Key &key) const { return findOrdinal(key) >= 0; }
+    /**
+     * @return values of @p key, empty if not found.
+     */
+    std::vector<Value> findEntry(const Key &key) const
     {
-        IndexNode const *previousNode = &m_rootNode;
-        int n = key.length();
-        int index = 0;
-        for (; index < n; ++index) {
-            IndexNode *child = previousNode->findChild(key[index]);
-            if (!child)
-                break;
-            previousNode = child;
-        }
-        if (index < n || previousNode == &m_rootNode)
-            return nullptr;
-        return const_cast<IndexNode *>(previousNode);
+        int64_t ordinal = findOrdinal(key);
+        if (ordinal < 0)
+            return {};
+        return valuesAt(ordinal);
+    }
+    /**
+     * @return at most @p limit keys starting with @p prefix in ascending order, including @p prefix itself.
+     */
+    std::vector<Key> findPrefix(const Key &prefix, size_t limit) const
+    {
+        std::vector<Key> keys;
+        Size node;
+        int64_t ordinal;
+        if (limit == 0 || prefix.size() == 0 || !descend(prefix, node, ordinal))
+            return keys;
+        Key key = prefix;
+        walk(node, key, ordinal, [&](const Key &k, size_t) {
+            keys.push_back(k);
+            return keys.size() < limit;
+        });
+        return keys;
     }
-    std::vector<std::pair<Key, IndexNode *>> allEntries() const
-    {
-        std::vector<std::pair<Key, IndexNode *>> entries;
-        IndexNode *levelMarker = nullptr;
-        std::vector<KeyIter> keySequence;
-        std::stack<const IndexNode *> s;
-        s.push(&m_rootNode);
-        while (!s.empty()) {
-            IndexNode *node = const_cast<IndexNode *>(s.top());
-            s.pop();
-            if (node == levelMarker) {
-                keySequence.pop_back();
+    /**
+     * Intersects the Levenshtein automaton of @p key with the index, i.e. walks the index while keeping a row of the
+     * edit distance matrix per depth, and prunes a subtree as soon as every cell of its row exceeds @p maxDistance.
+     * Only the diagonal band of width 2 * @p maxDistance + 1 is computed, since cells outside of it can't be within
+     * @p maxDistance. Swapping two adjacent characters counts as a single edit.
+     * @return at most @p limit keys within @p maxDistance edits of @p key with their distances, closest first and
+     * in ascending order for the same distance.
+     */
+    std::vector<std::pair<Key, int>> findFuzzy(const Key &key, int maxDistance, size_t limit) const
+    {
+        std::vector<std::pair<Key, int>> matches;
+        const int n = key.size();
+        if (!m_data || limit == 0 || n == 0 || maxDistance < 0)
+            return matches;
+
+        struct Frame
+        {
+            Size edge; // next edge to take
+            Size end;
+        };
+        const int width = n + 1;
+        const int unreachable = maxDistance + 1; // cells are capped, only distances up to `maxDistance` matter
+        std::vector<int> rows(width);            // row of depth d starts at d * width
+        for (int i = 0; i < width; ++i)
+            rows[i] = std::min(i, unreachable);
+        std::vector<Frame> frames{{m_nodes[0].firstEdge, m_nodes[0].firstEdge + m_nodes[0].edgeCount()}};
+        Key prefix;
+        while (!frames.empty()) {
+            Frame &frame = frames.back();
+            if (frame.edge == frame.end) {
+                frames.pop_back();
+                if (!frames.empty()) {
+                    prefix.resize(prefix.size() - 1);
+                    rows.resize(rows.size() - width);
+                }
                 continue;
             }
-            keySequence.push_back(node->_key);
-            if (!node->_value.empty()) {
-                Key key;
-                for (auto it = ++keySequence.begin(); it != keySequence.end(); ++it)
-                    key.push_back(*it);
-                entries.push_back({key, node});
+            Size edge = frame.edge++;
+            const KeyIter c = m_edgeKeys[edge];
+            const int depth = prefix.size() + 1;
+            rows.resize(rows.size() + width);
+            int *row = rows.data() + depth * width;
+            const int *prev = row - width;
+            const int *prev2 = depth > 1 ? prev - width : nullptr;
+            const int lo = std::max(1, depth - maxDistance);
+            const int hi = std::min(n, depth + maxDistance);
+            row[0] = std::min(depth, unreachable);
+            int best = row[0];
+            for (int i = 1; i < lo; ++i)
+                row[i] = unreachable;
+            for (int i = lo; i <= hi; ++i) {
+                int d = std::min(prev[i - 1] + (key[i - 1] == c ? 0 : 1), std::min(prev[i], row[i - 1]) + 1);
+                if (prev2 && i > 1 && key[i - 1] == prefix[depth - 2] && key[i - 2] == c)
+                    d = std::min(d, prev2[i - 2] + 1);
+                row[i] = std::min(d, unreachable);
+                best = std::min(best, row[i]);
+            }
+            for (int i = hi + 1; i < width; ++i)
+                row[i] = unreachable;
+            if (best > maxDistance) {
+                rows.resize(rows.size() - width);
+                continue;
             }
-            s.push(levelMarker);
-            for (auto it = node->_children.rbegin(); it != node->_children.rend(); ++it)
-                s.push(*it);
+            prefix.push_back(c);
+            const Node &child = m_nodes[m_edgeTargets[edge]];
+            if (child.final() && row[n] <= maxDistance)
+                matches.emplace_back(prefix, row[n]);
+            frames.push_back({child.firstEdge, child.firstEdge + child.edgeCount()});
         }
+
+        // keys are found in ascending order, so a stable sort keeps that order for the same distance
+        std::stable_sort(matches.begin(), matches.end(), [](const auto &lhs, const auto &rhs) {
+            return lhs.second < rhs.second;
+        });
+        if (matches.size() > limit)
+            matches.resize(limit);
+        return matches;
+    }
+    /**
+     * Visits all keys in ascending order with their ordinals, i.e. their positions among all keys, until @p visit
+     * returns @c false.
+     */
+    template<typename Visitor>
+    void forEachKey(Visitor &&visit) const
+    {
+        if (!m_data)
+            return;
+        Key key;
+        walk(0, key, 0, visit);
+    }
+    /**
+     * @return values of the key at @p ordinal, see `forEachKey`.
+     */
+    std::vector<Value> valuesAt(size_t ordinal) const
+    {
+        if (!m_data || ordinal >= keyCount())
+            return {};
+        Size begin = m_imageValueOffsets[ordinal];
+        Size end = m_imageValueOffsets[ordinal + 1];
+        std::vector<Value> values(end - begin);
+        const unsigned char *data = m_imageValues + static_cast<size_t>(begin) * m_header->valueSize;
+        for (auto &value : values)
+            _deserialize(data, value);
+        return values;
+    }
+    std::vector<std::pair<Key, std::vector<Value>>> allEntries() const
+    {
+        std::vector<std::pair<Key, std::vector<Value>>> entries;
+        if (!m_data)
+            return entries;
+        Key key;
+        walk(0, key, 0, [&](const Key &k, size_t ordinal) {
+            entries.push_back({k, valuesAt(ordinal)});
+            return true;
+        });
         return entries;
     }
     void clear()
     {
-        IndexNode *node;
-        std::stack<IndexNode *> s;
-        for (const auto &child : m_rootNode._children)
-            s.push(child);
-        while (!s.empty()) {
-            node = s.top();
-            s.pop();
-            for (const auto &child : node->_children)
-                s.push(child);
-            delete node;
-        }
-
-        m_rootNode._children.clear();
-        m_rootNode._children.shrink_to_fit();
-        m_uncheckedNodes.clear();
-        m_uncheckedNodes.shrink_to_fit();
-        // m_checkedNodes.clear();
+        releaseNodes();
+        m_valueOffsets.clear();
+        m_valueOffsets.shrink_to_fit();
+        m_values.clear();
+        m_values.shrink_to_fit();
         m_prevKey = Key();
         m_nodeCount = 0;
+        m_trieNodeCount = 0;
+        m_edgeCount = 0;
+        m_keyCount = 0;
         m_entryCount = 0;
+
+        m_buffer.clear();
+        m_buffer.shrink_to_fit();
+        if (m_file.isOpen()) {
+            m_file.unmap(const_cast<uchar *>(m_data));
+            m_file.close();
+        }
+        m_data = nullptr;
+        m_header = nullptr;
 #ifdef Q_OS_LINUX
         malloc_trim(0); // release memory back to OS
 #endif
     }
-    void minimize(int upTo){
-        // for (auto it = m_uncheckedNodes.end() - 1; it > m_uncheckedNodes.begin() + upTo; --it) {
-        //     auto node = m_checkedNodes.find(**it);
-        //     if (node == m_checkedNodes.end())
-        //         m_checkedNodes[**it] = *it;
-        //     else
-        //         (*node).second->_value.insert((*node).second->_value.end(), (*it)->_value.begin(), (*it)->_value.end());
-        //     IndexNode *parent = *(it - 1);
-        //     auto pos = std::lower_bound(parent->_children.begin(),
-        //                                 parent->_children.end(),
-        //                                 *it,
-        //                                 [](const auto &lhs, const auto &rhs) { return lhs->_key < rhs->_key; });
-        //     *pos = m_checkedNodes[**it];
-        //     if (node != m_checkedNodes.end())
-        //         delete *it;
-        //     m_uncheckedNodes.pop_back();
-        // }
-    };
-    void finish() { minimize(0); }
-    size_t serialize(FILE *fp)
+    /**
+     * Merges every unchecked node deeper than @p upTo with its equivalent checked node if there is one.
+     */
+    void minimize(size_t upTo)
     {
-        size_t bytes = byteCount();
-        unsigned char *buf = (unsigned char *) malloc(bytes);
-        unsigned char *start = buf;
-
-        IndexNode *node;
-        std::stack<IndexNode *> s;
-        s.push(&m_rootNode);
-        while (!s.empty()) {
-            node = s.top();
-            s.pop();
-            _serialize(start, *node);
-            for (auto it = node->_children.rbegin(); it != node->_children.rend(); ++it)
-                s.push(*it);
+        while (m_uncheckedNodes.size() > upTo + 1) {
+            size_t depth = m_uncheckedNodes.size() - 1;
+            IndexNode *node = m_uncheckedNodes.back();
+            m_uncheckedNodes.pop_back();
+            std::vector<IndexNode *> &children = m_pendingChildren[depth];
+            node->_children = children.data();
+            node->_childCount = children.size();
+            node->_count = node->_final ? 1 : 0;
+            for (const auto &child : children)
+                node->_count += child->_count;
+            auto pos = m_checkedNodes.find(node);
+            if (pos == m_checkedNodes.end()) {
+                setChildren(node, children);
+                m_checkedNodes.insert(node);
+            } else {
+                // `node` is always the rightest child of its parent
+                m_pendingChildren[depth - 1].back() = *pos;
+                --m_nodeCount;
+                m_edgeCount -= children.size();
+                m_freeNodes.push_back(node);
+            }
+            children.clear();
         }
-        fwrite(&bytes, sizeof(bytes), 1, fp);
-        fwrite(buf, bytes, 1, fp);
-        free(buf);
-        return bytes;
     }
-    size_t deserialize(FILE *fp)
+    /**
+     * Minimizes the remaining nodes and compiles the index into its image. Nodes and values added so far are
+     * released afterwards.
+     */
+    void finish()
     {
-        size_t bytes;
-        fread(&bytes, sizeof(bytes), 1, fp);
-        unsigned char *buf = (unsigned char *) malloc(bytes);
-        fread(buf, bytes, 1, fp);
-        unsigned char *start = buf;
+        if (m_data)
+            return;
+        minimize(0);
+        setChildren(&m_rootNode, m_pendingChildren[0]);
+        m_checkedNodes = decltype(m_checkedNodes)(); // only needed while adding entries
 
-        IndexNode *node;
-        std::stack<IndexNode *> ancestors;
-        std::stack<IndexNode *> s;
-        s.push(&m_rootNode);
-        while (!s.empty()) {
-            node = s.top();
-            s.pop();
-            _deserialize(start, *node);
-            if (!ancestors.empty()) {
-                ancestors.top()->_children.push_back(node);
-                if (ancestors.top()->_children.size() == ancestors.top()->_children.capacity())
-                    ancestors.pop();
+        std::vector<const IndexNode *> nodes{&m_rootNode};
+        std::unordered_map<const IndexNode *, Size> ids{{&m_rootNode, 0}};
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            for (uint32_t j = 0; j < nodes[i]->_childCount; ++j) {
+                if (ids.emplace(nodes[i]->_children[j], nodes.size()).second)
+                    nodes.push_back(nodes[i]->_children[j]);
             }
-            if (node->_children.capacity() > 0)
-                ancestors.push(node);
-            for (size_t i = 0; i < node->_children.capacity(); ++i)
-                s.push(new IndexNode);
         }
-        free(buf);
-        return 0;
+
+        Header header{Magic,
+                      sizeof(KeyIter),
+                      static_cast<uint32_t>(_serializedSize(Value())),
+                      static_cast<Size>(nodes.size()),
+                      static_cast<Size>(m_edgeCount),
+                      static_cast<Size>(m_keyCount),
+                      static_cast<Size>(m_entryCount),
+                      0};
+        Layout l = layout(header);
+        m_buffer.assign(l.size, 0);
+        unsigned char *data = m_buffer.data();
+        memcpy(data, &header, sizeof(header));
+        Node *imageNodes = reinterpret_cast<Node *>(data + l.nodes);
+        KeyIter *edgeKeys = reinterpret_cast<KeyIter *>(data + l.edgeKeys);
+        Size *edgeTargets = reinterpret_cast<Size *>(data + l.edgeTargets);
+        Size *edgeBases = reinterpret_cast<Size *>(data + l.edgeBases);
+        Size edge = 0;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            const IndexNode *node = nodes[i];
+            imageNodes[i].firstEdge = edge;
+            imageNodes[i].info = static_cast<Size>(node->_childCount) << 1 | (node->_final ? 1 : 0);
+            Size base = node->_final ? 1 : 0;
+            for (uint32_t j = 0; j < node->_childCount; ++j) {
+                const IndexNode *child = node->_children[j];
+                edgeKeys[edge] = child->_key;
+                edgeTargets[edge] = ids[child];
+                edgeBases[edge] = base;
+                base += child->_count;
+                ++edge;
+            }
+        }
+        Size *valueOffsets = reinterpret_cast<Size *>(data + l.valueOffsets);
+        for (size_t i = 0; i < m_valueOffsets.size(); ++i)
+            valueOffsets[i] = m_valueOffsets[i];
+        valueOffsets[m_keyCount] = m_entryCount;
+        unsigned char *values = data + l.values;
+        for (const auto &value : m_values)
+            _serialize(values, value);
+
+        releaseNodes();
+        m_valueOffsets = decltype(m_valueOffsets)();
+        m_values = decltype(m_values)();
+        attach(m_buffer.data(), m_buffer.size());
     }
-    inline size_t nodeCount() const { return m_nodeCount; }
-    inline size_t entryCount() const { return m_entryCount; }
-    size_t byteCount() const
-    {
-        size_t bytes = (nodeCount() + 1 /* m_rootNode */)
-                           * (sizeof(KeyIter) + sizeof(uint8_t /* num of values */)
-                              + sizeof(uint16_t /* num of children */))
-                       + entryCount() * sizeof(Value);
+    /**
+     * Writes the image. Must be called after `finish`.
+     */
+    size_t serialize(FILE *fp)
+    {
+        if (!m_data)
+            return 0;
+        size_t bytes = byteCount();
+        if (fwrite(m_data, bytes, 1, fp) != 1)
+            return 0;
         return bytes;
     }
+    /**
+     * Maps an index file written by `serialize` and queries it in place.
+     * @return @c true if successful, @c false otherwise, also if the file is corrupt.
+     */
+    bool map(const QString &fileName)
+    {
+        clear();
+        m_file.setFileName(fileName);
+        if (!m_file.open(QIODevice::ReadOnly))
+            return false;
+        qint64 size = m_file.size();
+        uchar *data = size > 0 ? m_file.map(0, size) : nullptr;
+        if (!data) {
+            m_file.close();
+            return false;
+        }
+        m_data = data;
+        if (!attach(data, size)) {
+            clear();
+            return false;
+        }
+        return true;
+    }
+    /**
+     * @return number of nodes (excluding the root node).
+     */
+    inline size_t nodeCount() const { return m_header ? m_header->nodeCount - 1 : m_nodeCount; }
+    /**
+     * @return number of nodes (excluding the root node) the index would have without minimization.
+     */
+    inline size_t trieNodeCount() const { return m_trieNodeCount ? m_trieNodeCount : nodeCount(); }
+    inline size_t keyCount() const { return m_header ? m_header->keyCount : m_keyCount; }
+    inline size_t entryCount() const { return m_header ? m_header->entryCount : m_entryCount; }
+    /**
+     * @return size of the image.
+     */
+    size_t byteCount() const { return m_header ? m_size : 0; }
 
 private:
+    static inline size_t align(size_t offset) { return (offset + 7) & ~static_cast<size_t>(7); }
+    static Layout layout(const Header &header)
+    {
+        Layout l;
+        l.nodes = align(sizeof(Header));
+        l.edgeKeys = align(l.nodes + static_cast<size_t>(header.nodeCount) * sizeof(Node));
+        l.edgeTargets = align(l.edgeKeys + static_cast<size_t>(header.edgeCount) * sizeof(KeyIter));
+        l.edgeBases = align(l.edgeTargets + static_cast<size_t>(header.edgeCount) * sizeof(Size));
+        l.valueOffsets = align(l.edgeBases + static_cast<size_t>(header.edgeCount) * sizeof(Size));
+        l.values = align(l.valueOffsets + (static_cast<size_t>(header.keyCount) + 1) * sizeof(Size));
+        l.size = l.values + static_cast<size_t>(header.entryCount) * header.valueSize;
+        return l;
+    }
+    /**
+     * Checks that every edge, base and value offset of the image stays within its section, so that a stale or corrupt
+     * index file of the right size is rebuilt instead of being read out of bounds.
+     */
+    static bool validate(const unsigned char *data, const Layout &l, const Header &header)
+    {
+        const Node *nodes = reinterpret_cast<const Node *>(data + l.nodes);
+        for (Size i = 0; i < header.nodeCount; ++i) {
+            if (static_cast<uint64_t>(nodes[i].firstEdge) + nodes[i].edgeCount() > header.edgeCount)
+                return false;
+        }
+        const Size *edgeTargets = reinterpret_cast<const Size *>(data + l.edgeTargets);
+        const Size *edgeBases = reinterpret_cast<const Size *>(data + l.edgeBases);
+        for (Size i = 0; i < header.edgeCount; ++i) {
+            if (edgeTargets[i] == 0 || edgeTargets[i] >= header.nodeCount || edgeBases[i] > header.keyCount)
+                return false;
+        }
+        const Size *valueOffsets = reinterpret_cast<const Size *>(data + l.valueOffsets);
+        for (Size i = 0; i < header.keyCount; ++i) {
+            if (valueOffsets[i] > valueOffsets[i + 1])
+                return false;
+        }
+        return valueOffsets[header.keyCount] == header.entryCount;
+    }
+    bool attach(const unsigned char *data, size_t size)
+    {
+        if (size < sizeof(Header))
+            return false;
+        const Header *header = reinterpret_cast<const Header *>(data);
+        if (header->magic != Magic || header->keySize != sizeof(KeyIter)
+            || header->valueSize != _serializedSize(Value()) || header->nodeCount == 0)
+            return false;
+        Layout l = layout(*header);
+        if (l.size > size || !validate(data, l, *header))
+            return false;
+        m_data = data;
+        m_size = l.size;
+        m_header = header;
+        m_nodes = reinterpret_cast<const Node *>(data + l.nodes);
+        m_edgeKeys = reinterpret_cast<const KeyIter *>(data + l.edgeKeys);
+        m_edgeTargets = reinterpret_cast<const Size *>(data + l.edgeTargets);
+        m_edgeBases = reinterpret_cast<const Size *>(data + l.edgeBases);
+        m_imageValueOffsets = reinterpret_cast<const Size *>(data + l.valueOffsets);
+        m_imageValues = data + l.values;
+        return true;
+    }
+    /**
+     * @return index of the edge with @p key leaving @p node, -1 if there is none.
+     */
+    inline int64_t findEdge(const Node &node, const KeyIter &key) const
+    {
+        const KeyIter *begin = m_edgeKeys + node.firstEdge;
+        const KeyIter *end = begin + node.edgeCount();
+        const KeyIter *pos = std::lower_bound(begin, end, key);
+        if (pos == end || *pos != key)
+            return -1;
+        return pos - m_edgeKeys;
+    }
+    /**
+     * Walks down @p key from the root.
+     * @param node the node reached by @p key.
+     * @param ordinal ordinal of the first key in the subtree of @p node.
+     * @return @c true if the whole @p key is walked down, @c false otherwise.
+     */
+    bool descend(const Key &key, Size &node, int64_t &ordinal) const
+    {
+        if (!m_data)
+            return false;
+        node = 0;
+        ordinal = 0;
+        int n = key.size();
+        for (int index = 0; index < n; ++index) {
+            int64_t edge = findEdge(m_nodes[node], key[index]);
+            if (edge < 0)
+                return false;
+            ordinal += m_edgeBases[edge];
+            node = m_edgeTargets[edge];
+        }
+        return true;
+    }
+    /**
+     * @return ordinal of @p key among all keys, -1 if not found.
+     */
+    int64_t findOrdinal(const Key &key) const
+    {
+        Size node;
+        int64_t ordinal;
+        if (key.size() == 0 || !descend(key, node, ordinal) || !m_nodes[node].final())
+            return -1;
+        return ordinal;
+    }
+    /**
+     * Visits keys below @p node in ascending order. @p key is the key of @p node and @p ordinal the ordinal of the
+     * first key in its subtree. Stops as soon as @p visit returns @c false.
+     */
+    template<typename Visitor>
+    void walk(Size node, Key &key, size_t ordinal, Visitor &&visit) const
+    {
+        struct Frame
+        {
+            Size edge; // next edge to take
+            Size end;
+        };
+        if (m_nodes[node].final() && !visit(static_cast<const Key &>(key), ordinal++))
+            return;
+        std::vector<Frame> frames{{m_nodes[node].firstEdge, m_nodes[node].firstEdge + m_nodes[node].edgeCount()}};
+        while (!frames.empty()) {
+            Frame &frame = frames.back();
+            if (frame.edge == frame.end) {
+                frames.pop_back();
+                if (!frames.empty())
+                    key.resize(key.size() - 1);
+                continue;
+            }
+            Size edge = frame.edge++;
+            const Node &child = m_nodes[m_edgeTargets[edge]];
+            key.push_back(m_edgeKeys[edge]);
+            if (child.final() && !visit(static_cast<const Key &>(key), ordinal++))
+                return;
+            frames.push_back({child.firstEdge, child.firstEdge + child.edgeCount()});
+        }
+    }
+    IndexNode *newNode(const KeyIter &key)
+    {
+        IndexNode *node;
+        if (m_freeNodes.empty()) {
+            node = m_arena.allocate<IndexNode>();
+        } else {
+            node = m_freeNodes.back();
+            m_freeNodes.pop_back();
+        }
+        return new (node) IndexNode(key);
+    }
+    void setChildren(IndexNode *node, const std::vector<IndexNode *> &children)
+    {
+        node->_childCount = children.size();
+        node->_children = m_arena.allocate<IndexNode *>(children.size());
+        std::copy(children.begin(), children.end(), node->_children);
+    }
+    void releaseNodes()
+    {
+        m_arena.release();
+        m_freeNodes = decltype(m_freeNodes)();
+        m_rootNode = IndexNode();
+        m_uncheckedNodes.clear();
+        m_uncheckedNodes.shrink_to_fit();
+        m_uncheckedNodes.push_back(&m_rootNode);
+        m_pendingChildren.clear();
+        m_pendingChildren.shrink_to_fit();
+        m_pendingChildren.emplace_back();
+        m_checkedNodes = decltype(m_checkedNodes)();
+    }
+
+    // used while adding entries
+    DictIndexArena m_arena;
+    std::vector<IndexNode *> m_freeNodes; // nodes merged by `minimize`, to be reused
     std::vector<IndexNode *> m_uncheckedNodes;
-    // std::unordered_map<IndexNode, IndexNode *> m_checkedNodes;
+    std::vector<std::vector<IndexNode *>> m_pendingChildren; // children of `m_uncheckedNodes` at the same depth
+    std::unordered_set<IndexNode *, NodeHash, NodeEqual> m_checkedNodes;
     IndexNode m_rootNode;
+    std::vector<size_t> m_valueOffsets; // offset in `m_values` of each key
+    std::vector<Value> m_values;
     Key m_prevKey;
     size_t m_nodeCount = 0;
+    size_t m_trieNodeCount = 0;
+    size_t m_edgeCount = 0;
+    size_t m_keyCount = 0;
     size_t m_entryCount = 0;
-};
 
-template<typename T>
-inline void _serialize(unsigned char *&data, const T &object)
-{
-    memcpy(data, &object, sizeof(T));
-    data += sizeof(T);
-}
-
-template<typename T>
-inline void _deserialize(unsigned char *&data, T &object)
-{
-    memcpy(&object, data, sizeof(T));
-    data += sizeof(T);
-}
-
-template<typename T>
-inline void _serialize(unsigned char *&data, const std::vector<T> &vec)
-{
-    uint8_t size = vec.size();
-    _serialize(data, size);
-    for (int i = 0; i < size; ++i)
-        _serialize(data, vec[i]);
-}
-
-template<typename T>
-inline void _deserialize(unsigned char *&data, std::vector<T> &vec)
-{
-    uint8_t size;
-    _deserialize(data, size);
-    vec.resize(size);
-    for (int i = 0; i < size; ++i)
-        _deserialize(data, vec[i]);
-}
-
-template<typename T1, typename T2, typename T3>
-inline void _serialize(unsigned char *&data, const std::tuple<T1, T2, T3> &t)
-{
-    _serialize(data, std::get<0>(t));
-    _serialize(data, std::get<1>(t));
-    _serialize(data, std::get<2>(t));
-}
-
-template<typename T1, typename T2, typename T3>
-inline void _deserialize(unsigned char *&data, std::tuple<T1, T2, T3> &t)
-{
-    _deserialize(data, std::get<0>(t));
-    _deserialize(data, std::get<1>(t));
-    _deserialize(data, std::get<2>(t));
-}
-
-template<typename T1, typename T2>
-inline void _serialize(unsigned char *&data, const std::pair<T1, T2> &pair)
-{
-    _serialize(data, pair.first);
-    _serialize(data, pair.second);
-}
-
-template<typename T1, typename T2>
-inline void _deserialize(unsigned char *&data, std::pair<T1, T2> &pair)
-{
-    _deserialize(data, pair.first);
-    _deserialize(data, pair.second);
-}
-
-template<typename Key, typename Value>
-inline void _serialize(unsigned char *&data, const DictIndexNode<Key, Value> &node)
-{
-    _serialize(data, node._key);
-    _serialize(data, node._value);
-    _serialize(data, static_cast<uint16_t>(node._children.size()));
-}
-
-template<typename Key, typename Value>
-inline void _deserialize(unsigned char *&data, DictIndexNode<Key, Value> &node)
-{
-    _deserialize(data, node._key);
-    _deserialize(data, node._value);
-    uint16_t size;
-    _deserialize(data, size);
-    node._children.reserve(size);
-}
+    // image, either built by `finish` or mapped by `map`
+    std::vector<unsigned char> m_buffer;
+    QFile m_file;
+    const unsigned char *m_data = nullptr;
+    size_t m_size = 0;
+    const Header *m_header = nullptr;
+    const Node *m_nodes = nullptr;
+    const KeyIter *m_edgeKeys = nullptr;
+    const Size *m_edgeTargets = nullptr;
+    const Size *m_edgeBases = nullptr;
+    const Size *m_imageValueOffsets = nullptr;
+    const unsigned char *m_imageValues = nullptr;
+};
 
 #endif // DICTINDEX_H
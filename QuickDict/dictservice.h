@@ -28,7 +28,11 @@ public:
 
 Q_SIGNALS:
     void delegateChanged();
-    void query(const QString &text);
+    /**
+     * @param queryId id of the query, to be put into the "id" field of its results. Results of earlier queries are
+     * dropped.
+     */
+    void query(const QString &text, int queryId);
     void queryResult(const QJsonObject &result);
 
 private:
@@ -0,0 +1,262 @@
+#include "dictzipfile.h"
+#include "dictservice.h"
+#include "trace.h"
+#include <algorithm>
+#include <zlib.h>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+// flags of the gzip header, see RFC 1952
+const uchar FHCRC = 0x02;
+const uchar FEXTRA = 0x04;
+const uchar FNAME = 0x08;
+const uchar FCOMMENT = 0x10;
+
+inline quint16 readLE16(const uchar *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+} // namespace
+
+DictZipFile::DictZipFile()
+{
+    m_cache.setMaxCost(8 * 1024 * 1024);
+}
+
+DictZipFile::~DictZipFile()
+{
+    close();
+}
+
+bool DictZipFile::open(const QString &fileName)
+{
+    close();
+    m_file.setFileName(fileName);
+    m_size = m_file.size();
+    if (!m_file.open(QIODevice::ReadOnly) || m_size <= 0 || !(m_data = m_file.map(0, m_size))) {
+        m_errorString = QString("Failed to map file %1").arg(fileName);
+        close();
+        return false;
+    }
+#ifdef Q_OS_UNIX
+    // lookups jump between chunks, read-ahead would only waste page cache
+    madvise(const_cast<uchar *>(m_data), m_size, MADV_RANDOM);
+#endif
+    if (!readHeader()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void DictZipFile::close()
+{
+    m_cacheMutex.lock();
+    m_cache.clear();
+    m_cacheMutex.unlock();
+    if (m_data) {
+        m_file.unmap(const_cast<uchar *>(m_data));
+        m_data = nullptr;
+    }
+    m_file.close();
+    m_size = 0;
+    m_chunkLength = 0;
+    m_chunkOffsets.clear();
+    m_uncompressedSize = 0;
+}
+
+bool DictZipFile::readHeader()
+{
+    const uchar *p = m_data;
+    const uchar *end = m_data + m_size;
+    if (m_size < 10 || p[0] != 0x1f || p[1] != 0x8b) {
+        m_uncompressedSize = m_size;
+        return true;
+    }
+    m_errorString = QString("Invalid dictzip header in %1").arg(m_file.fileName());
+    uchar flags = p[3];
+    p += 10;
+    if (!(flags & FEXTRA) || end - p < 2) {
+        m_errorString = QString("%1 is gzip but not dictzip, it can't be read randomly").arg(m_file.fileName());
+        return false;
+    }
+    const uchar *extraEnd = p + 2 + readLE16(p);
+    if (extraEnd > end)
+        return false;
+
+    // the chunk table is the "RA" subfield, files with more chunks than one subfield holds have several of them
+    std::vector<quint16> chunkSizes;
+    for (p += 2; extraEnd - p >= 4;) {
+        uchar si1 = p[0], si2 = p[1];
+        quint16 length = readLE16(p + 2);
+        p += 4;
+        if (length > extraEnd - p)
+            return false;
+        if (si1 == 'R' && si2 == 'A') {
+            if (length < 6 || readLE16(p) != 1)
+                return false;
+            quint16 chunkLength = readLE16(p + 2);
+            quint16 chunkCount = readLE16(p + 4);
+            if (chunkLength == 0 || length < 6 + 2 * chunkCount || (m_chunkLength && chunkLength != m_chunkLength))
+                return false;
+            m_chunkLength = chunkLength;
+            for (int i = 0; i < chunkCount; ++i)
+                chunkSizes.push_back(readLE16(p + 6 + 2 * i));
+        }
+        p += length;
+    }
+    if (chunkSizes.empty()) {
+        m_errorString = QString("%1 is gzip but not dictzip, it can't be read randomly").arg(m_file.fileName());
+        m_chunkLength = 0;
+        return false;
+    }
+
+    // a truncated header may lack the terminators of its strings
+    p = extraEnd;
+    for (uchar flag : {FNAME, FCOMMENT}) {
+        if (flags & flag) {
+            p = std::find(p, end, 0);
+            if (p == end)
+                return false;
+            ++p;
+        }
+    }
+    if (flags & FHCRC)
+        p += 2;
+    if (p > end)
+        return false;
+    quint64 offset = p - m_data;
+    for (quint16 size : chunkSizes) {
+        m_chunkOffsets.push_back(offset);
+        offset += size;
+    }
+    m_chunkOffsets.push_back(offset);
+    if (offset > static_cast<quint64>(m_size))
+        return false;
+    m_uncompressedSize = static_cast<quint64>(m_chunkLength) * chunkSizes.size();
+    m_errorString.clear();
+    return true;
+}
+
+QByteArray DictZipFile::read(quint64 offset, quint32 size)
+{
+    if (offset > m_uncompressedSize || size > m_uncompressedSize - offset)
+        return QByteArray();
+    if (!isCompressed())
+        return QByteArray(reinterpret_cast<const char *>(m_data + offset), size);
+    if (size == 0)
+        return QByteArray("");
+
+    QByteArray result;
+    result.reserve(size);
+    quint64 endOffset = offset + size;
+    for (quint32 index = offset / m_chunkLength; index <= (endOffset - 1) / m_chunkLength; ++index) {
+        QByteArray data;
+        if (!chunk(index, data))
+            return QByteArray();
+        quint64 chunkOffset = static_cast<quint64>(index) * m_chunkLength;
+        quint64 from = std::max(offset, chunkOffset) - chunkOffset;
+        quint64 to = std::min<quint64>(endOffset - chunkOffset, data.size());
+        if (to <= from)
+            return QByteArray(); // beyond the shorter last chunk
+        result.append(data.constData() + from, to - from);
+    }
+    return result.size() == static_cast<int>(size) ? result : QByteArray();
+}
+
+bool DictZipFile::chunk(quint32 index, QByteArray &data)
+{
+    QMutexLocker locker(&m_cacheMutex);
+    if (QByteArray *cached = m_cache.object(index)) {
+        ++m_cacheHits;
+        data = *cached;
+        return true;
+    }
+    ++m_cacheMisses;
+    locker.unlock();
+
+    TraceSpan span(qdDict(), "dictzip_inflate");
+    // chunks are raw deflate data, flushed fully at their ends so that each can be inflated on its own
+    z_stream stream{};
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+        return false;
+    data = QByteArray(m_chunkLength, Qt::Uninitialized);
+    stream.next_in = const_cast<Bytef *>(m_data + m_chunkOffsets[index]);
+    stream.avail_in = m_chunkOffsets[index + 1] - m_chunkOffsets[index];
+    stream.next_out = reinterpret_cast<Bytef *>(data.data());
+    stream.avail_out = m_chunkLength;
+    int ret = inflate(&stream, Z_SYNC_FLUSH);
+    inflateEnd(&stream);
+    if (ret != Z_OK && ret != Z_STREAM_END) {
+        data.clear();
+        return false;
+    }
+    data.resize(m_chunkLength - stream.avail_out);
+
+    locker.relock();
+    m_cache.insert(index, new QByteArray(data), data.size());
+    return true;
+}
+
+int DictZipFile::cacheSize() const
+{
+    QMutexLocker locker(&m_cacheMutex);
+    return m_cache.maxCost();
+}
+
+void DictZipFile::setCacheSize(int cacheSize)
+{
+    QMutexLocker locker(&m_cacheMutex);
+    m_cache.setMaxCost(cacheSize);
+}
+
+QVariantMap DictZipFile::cacheStats() const
+{
+    QMutexLocker locker(&m_cacheMutex);
+    quint64 lookups = m_cacheHits + m_cacheMisses;
+    return QVariantMap{{"hits", m_cacheHits},
+                       {"misses", m_cacheMisses},
+                       {"hitRate", lookups ? qreal(m_cacheHits) / lookups : 0.0},
+                       {"chunks", m_cache.count()},
+                       {"bytes", m_cache.totalCost()}};
+}
+
+bool DictZipFile::readGzip(const QString &fileName, QByteArray &data)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    const QByteArray compressed = file.readAll();
+    file.close();
+
+    // 16 tells zlib to expect a gzip header
+    z_stream stream{};
+    if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK)
+        return false;
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(compressed.constData()));
+    stream.avail_in = compressed.size();
+    // guessed from the compression ratio, and bounded by what a QByteArray holds
+    const qint64 maxSize = 1 << 30;
+    data.resize(qBound<qint64>(4096, static_cast<qint64>(compressed.size()) * 4, maxSize));
+    int ret;
+    do {
+        if (stream.total_out == static_cast<uLong>(data.size())) {
+            if (data.size() >= maxSize) {
+                ret = Z_BUF_ERROR;
+                break;
+            }
+            data.resize(std::min<qint64>(static_cast<qint64>(data.size()) * 2, maxSize));
+        }
+        stream.next_out = reinterpret_cast<Bytef *>(data.data() + stream.total_out);
+        stream.avail_out = data.size() - stream.total_out;
+        ret = inflate(&stream, Z_NO_FLUSH);
+    } while (ret == Z_OK);
+    data.resize(stream.total_out);
+    inflateEnd(&stream);
+    return ret == Z_STREAM_END;
+}
@@ -0,0 +1,84 @@
+#ifndef DICTZIPFILE_H
+#define DICTZIPFILE_H
+
+#include <QByteArray>
+#include <QCache>
+#include <QFile>
+#include <QMutex>
+#include <QVariantMap>
+#include <vector>
+
+/**
+ * DictZipFile reads ranges of dictionary data stored as dictzip, which is gzip compressed in chunks of usually 64 KB
+ * that a table in the gzip header locates, so that any range can be read by inflating just the chunks it covers.
+ * Uncompressed files are read as they are.
+ *
+ * The file is mapped and inflated chunks are kept in a cache limited to `cacheSize` bytes. Safe to read from any
+ * thread while open.
+ */
+class DictZipFile
+{
+public:
+    DictZipFile();
+    ~DictZipFile();
+
+    /**
+     * Maps @p fileName and reads its chunk table if it is a dictzip file.
+     * @return @c true if successful, @c false otherwise, see `errorString`.
+     */
+    bool open(const QString &fileName);
+    void close();
+    inline bool isOpen() const { return m_data != nullptr; }
+    /**
+     * @return @c true if the file is a dictzip file, @c false if it is uncompressed.
+     */
+    inline bool isCompressed() const { return m_chunkLength > 0; }
+    inline QString fileName() const { return m_file.fileName(); }
+    inline QString errorString() const { return m_errorString; }
+
+    /**
+     * @return @p size bytes from uncompressed @p offset, a null array if the range is out of the file or a chunk
+     * can't be inflated.
+     */
+    QByteArray read(quint64 offset, quint32 size);
+
+    /**
+     * @return maximum bytes of inflated chunks kept in memory.
+     */
+    int cacheSize() const;
+    void setCacheSize(int cacheSize);
+    /**
+     * @return hits, misses, hit rate and current usage of the chunk cache.
+     */
+    QVariantMap cacheStats() const;
+
+    /**
+     * Inflates the whole gzip file @p fileName, dictzip or not, into @p data.
+     * @return @c true if successful, @c false otherwise, also if it inflates to more than 1 GiB.
+     */
+    static bool readGzip(const QString &fileName, QByteArray &data);
+
+private:
+    bool readHeader();
+    /**
+     * Inflates chunk @p index unless it is cached.
+     * @return @c true if successful, @c false otherwise.
+     */
+    bool chunk(quint32 index, QByteArray &data);
+
+    QFile m_file;
+    const uchar *m_data = nullptr; // the whole file
+    qint64 m_size = 0;
+    QString m_errorString;
+
+    quint32 m_chunkLength = 0;           // uncompressed, 0 if the file is not compressed
+    std::vector<quint64> m_chunkOffsets; // in the file, followed by the end of the last chunk
+    quint64 m_uncompressedSize = 0;      // an upper bound, the last chunk may be shorter
+
+    QCache<quint32, QByteArray> m_cache; // cost is the size of the chunk in bytes
+    mutable QMutex m_cacheMutex;         // guards the cache and its counters
+    quint64 m_cacheHits = 0;
+    quint64 m_cacheMisses = 0;
+};
+
+#endif // DICTZIPFILE_H
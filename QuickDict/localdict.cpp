@@ -1,30 +1,37 @@
 #include "localdict.h"
+#include "quickdict.h"
+#include "trace.h"
+#include <QCryptographicHash>
+#include <QDir>
 #include <QFileInfo>
 
 LocalDict::LocalDict(QObject *parent)
     : DictService(parent)
-{}
+{
+    m_loadingPool.setMaxThreadCount(1);
+    m_lookupPool.setMaxThreadCount(1);
+
+    connect(this, &LocalDict::query, this, &LocalDict::onQuery);
+}
 
-LocalDict::~LocalDict() {}
+LocalDict::~LocalDict()
+{
+    m_lookupPool.clear();
+    m_lookupPool.waitForDone();
+    m_loadingPool.clear();
+    m_loadingPool.waitForDone();
+}
 
 void LocalDict::setSource(const QString &source)
 {
-    if (source == m_dictFileName)
+    if (source == m_source)
         return;
 
-    m_dictFileName = source;
-    m_indexFileName = m_dictFileName + ".index"; // TODO: save index data to cache dir
-
-    if (loaded()) {
-        unloadDict();
-        unloadIndex();
-        setLoaded(false);
-    }
-    if (enabled() && !m_dictFileName.isEmpty()) {
-        if (loadDict() && loadOrBuildIndex())
-            setLoaded(true);
-    }
-    emit sourceChanged(m_dictFileName);
+    m_source = source;
+    unload();
+    if (enabled() && !m_source.isEmpty())
+        load();
+    emit sourceChanged(m_source);
 }
 
 void LocalDict::setSorted(bool sorted)
@@ -43,33 +50,238 @@ void LocalDict::setLoaded(bool loaded)
     emit loadedChanged(m_loaded);
 }
 
+void LocalDict::setBuildThreads(int buildThreads)
+{
+    if (m_buildThreads == buildThreads)
+        return;
+    m_buildThreads = buildThreads;
+    emit buildThreadsChanged(m_buildThreads);
+}
+
+QStringList LocalDict::completions(const QString &text, int limit) const
+{
+    if (!loaded() || limit <= 0)
+        return QStringList();
+    return findPrefix(QuickDict::instance()->normalizeKey(text.trimmed()), limit);
+}
+
+QStringList LocalDict::lookupKeys(const QStringList &candidates) const
+{
+    if (candidates.isEmpty())
+        return QStringList();
+    const QString &key = candidates.first();
+    if (containsKey(key))
+        return QStringList{key};
+    // look up stems only if the key itself is not a headword
+    QStringList stems;
+    for (int i = 1; i < candidates.size(); ++i) {
+        if (containsKey(candidates[i]))
+            stems << candidates[i];
+    }
+    if (!stems.isEmpty())
+        return stems;
+    // allow fewer typos in short words, otherwise almost any word would match
+    return findFuzzy(key, key.size() <= 4 ? 1 : 2, 5);
+}
+
 bool LocalDict::doSetEnabled(bool enabled)
 {
-    if (enabled && !m_dictFileName.isEmpty()) {
-        if (loadDict()) {
-            if (!loadOrBuildIndex()) {
-                unloadDict();
-                return false;
-            }
-            setLoaded(true);
-            return true;
-        } else {
-            return false;
-        }
-    } else if (!enabled && loaded()) {
+    if (enabled) {
+        if (!m_source.isEmpty())
+            load();
+    } else {
+        unload();
+    }
+    return true;
+}
+
+void LocalDict::shutdown()
+{
+    if (QuickDict::instance())
+        QuickDict::instance()->releaseDict(this);
+    m_lookupPool.clear();
+    m_lookupPool.waitForDone();
+    m_loadingPool.clear();
+    m_loadingPool.waitForDone();
+    if (m_dictLoaded) {
         unloadDict();
         unloadIndex();
-        setLoaded(false);
+        m_dictLoaded = false;
+    }
+}
+
+bool LocalDict::deferQuery(const QString &text, int queryId)
+{
+    if (loaded())
+        return false;
+    if (loading()) {
+        m_pendingQuery = text;
+        m_pendingQueryId = queryId;
+    } else {
+        qCDebug(qdDict) << "Dict:" << name() << "query: Not loaded, skip" << text;
     }
     return true;
 }
 
-bool LocalDict::loadOrBuildIndex()
+void LocalDict::onQuery(const QString &text, int queryId)
+{
+    if (deferQuery(text, queryId))
+        return;
+
+    const QStringList candidates = QuickDict::instance()->queryKeys(text);
+    if (candidates.isEmpty())
+        return;
+    startLookup(
+        [this, candidates]() {
+            QList<LocalDictHit> hits;
+            for (const QString &key : lookupKeys(candidates))
+                hits.append(LocalDictHit(key, -1));
+            return hits;
+        },
+        queryId);
+}
+
+void LocalDict::queryHits(const QList<LocalDictHit> &hits, int queryId)
 {
-    if (needBuildIndex())
-        return buildIndex();
+    if (!loaded())
+        return;
+    startLookup([hits]() { return hits; }, queryId);
+}
+
+void LocalDict::startLookup(const std::function<QList<LocalDictHit>()> &resolve, int queryId)
+{
+    m_lookupPool.clear();
+    m_lookupPool.start([this, resolve, queryId]() {
+        QReadLocker locker(&m_lock);
+        if (!m_dictLoaded || isStale(queryId))
+            return;
+        TraceSpan span(qdDict(), "lookup", name());
+        QList<LocalDictHit> hits;
+        {
+            TraceSpan resolveSpan(qdDict(), "lookupKeys");
+            hits = resolve();
+        }
+        if (hits.isEmpty())
+            qCDebug(qdDict) << "Dict:" << name() << "query: No entry";
+        for (const LocalDictHit &hit : hits) {
+            if (isStale(queryId) || !lookupKey(hit.first, hit.second, queryId))
+                return;
+        }
+        emit queryFinished(queryId);
+    });
+}
+
+bool LocalDict::enumerateKeys(const std::function<bool(const QString &, quint32)> &visit) const
+{
+    QReadLocker locker(&m_lock);
+    if (!m_dictLoaded)
+        return false;
+    forEachKey(visit);
+    return true;
+}
+
+bool LocalDict::isStale(int queryId) const
+{
+    return queryId != QuickDict::instance()->queryId();
+}
+
+void LocalDict::reportProgress(qreal progress)
+{
+    QMetaObject::invokeMethod(
+        this,
+        [this, progress]() {
+            if (loading())
+                setProgress(progress);
+        },
+        Qt::QueuedConnection);
+}
+
+void LocalDict::load()
+{
+    int generation = ++m_generation;
+    QString source = m_source;
+    setProgress(0);
+    setLoading(true);
+    m_loadingPool.start([this, generation, source]() {
+        QWriteLocker locker(&m_lock);
+        m_dictFileName = source;
+        m_indexFileName = indexFileName(m_dictFileName);
+        bool loaded = loadDict();
+        if (loaded) {
+            reportProgress(0.1);
+            loaded = loadOrBuildIndex();
+            if (!loaded)
+                unloadDict();
+        }
+        m_dictLoaded = loaded;
+        QMetaObject::invokeMethod(
+            this, [this, generation, loaded]() { finishLoading(generation, loaded); }, Qt::QueuedConnection);
+    });
+}
+
+void LocalDict::unload()
+{
+    ++m_generation;
+    m_pendingQuery.clear();
+    setLoaded(false);
+    setLoading(false);
+    m_lookupPool.clear();
+    m_loadingPool.start([this]() {
+        QWriteLocker locker(&m_lock);
+        if (m_dictLoaded) {
+            unloadDict();
+            unloadIndex();
+            m_dictLoaded = false;
+        }
+    });
+}
+
+void LocalDict::finishLoading(int generation, bool loaded)
+{
+    if (generation != m_generation)
+        return;
+    if (loaded)
+        setProgress(1);
     else
-        return loadIndex();
+        qCWarning(qdDict) << "Dict:" << name() << "error: Failed to load" << m_source;
+    setLoading(false);
+    setLoaded(loaded);
+    if (loaded && !m_pendingQuery.isEmpty() && !isStale(m_pendingQueryId))
+        emit query(m_pendingQuery, m_pendingQueryId);
+    m_pendingQuery.clear();
+}
+
+void LocalDict::setLoading(bool loading)
+{
+    if (m_loading == loading)
+        return;
+    m_loading = loading;
+    emit loadingChanged(m_loading);
+}
+
+void LocalDict::setProgress(qreal progress)
+{
+    if (m_progress == progress)
+        return;
+    m_progress = progress;
+    emit progressChanged(m_progress);
+}
+
+QString LocalDict::indexFileName(const QString &dictFileName)
+{
+    // dictionaries are often installed in read-only system dirs, and may share their names with others
+    QFileInfo dictFileInfo(dictFileName);
+    QByteArray pathHash = QCryptographicHash::hash(dictFileInfo.absoluteFilePath().toUtf8(), QCryptographicHash::Sha1);
+    QString fileName = QString("%1-%2.index").arg(dictFileInfo.fileName(), QString(pathHash.toHex().left(16)));
+    return QDir(QuickDict::cacheDirPath()).filePath(fileName);
+}
+
+bool LocalDict::loadOrBuildIndex()
+{
+    // rebuild indexes if they are outdated or in an incompatible format
+    if (!needBuildIndex() && loadIndex())
+        return true;
+    return buildIndex();
 }
 
 bool LocalDict::needBuildIndex()
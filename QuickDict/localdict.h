@@ -2,6 +2,18 @@
 #define LOCALDICT_H
 
 #include "dictservice.h"
+#include "utils.h"
+#include <QFile>
+#include <QReadWriteLock>
+#include <QThreadPool>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+
+/**
+ * A headword and its ordinal in the index, -1 if unknown.
+ */
+using LocalDictHit = QPair<QString, qint64>;
 
 class LocalDict : public DictService
 {
@@ -9,12 +21,15 @@ class LocalDict : public DictService
     Q_PROPERTY(QString source READ source WRITE setSource NOTIFY sourceChanged)
     Q_PROPERTY(bool sorted READ sorted WRITE setSorted NOTIFY sortedChanged)
     Q_PROPERTY(bool loaded READ loaded NOTIFY loadedChanged)
+    Q_PROPERTY(bool loading READ loading NOTIFY loadingChanged)
+    Q_PROPERTY(qreal progress READ progress NOTIFY progressChanged)
+    Q_PROPERTY(int buildThreads READ buildThreads WRITE setBuildThreads NOTIFY buildThreadsChanged)
 
 public:
     explicit LocalDict(QObject *parent = nullptr);
     virtual ~LocalDict();
 
-    inline QString source() const { return m_dictFileName; }
+    inline QString source() const { return m_source; }
     void setSource(const QString &source);
 
     inline bool sorted() const { return m_sorted; }
@@ -23,25 +38,231 @@ public:
     inline bool loaded() const { return m_loaded; }
     void setLoaded(bool loaded);
 
+    /**
+     * @return @c true while the dictionary is loaded or its indexes are built in the background.
+     */
+    inline bool loading() const { return m_loading; }
+    /**
+     * @return progress of loading in [0, 1].
+     */
+    inline qreal progress() const { return m_progress; }
+
+    /**
+     * @return number of threads used to build indexes, 0 means one per core.
+     */
+    inline int buildThreads() const { return m_buildThreads; }
+    void setBuildThreads(int buildThreads);
+
+    /**
+     * @return at most @p limit headwords starting with @p text in ascending order.
+     */
+    Q_INVOKABLE QStringList completions(const QString &text, int limit = 10) const;
+    /**
+     * @param prefix a normalized key, see `QuickDict::normalizeKey`.
+     */
+    virtual QStringList findPrefix(const QString &prefix, int limit) const = 0;
+    /**
+     * @param key a normalized key, see `QuickDict::normalizeKey`.
+     * @return @c true if @p key is a headword.
+     */
+    virtual bool containsKey(const QString &key) const = 0;
+    /**
+     * @param key a normalized key, see `QuickDict::normalizeKey`.
+     * @return at most @p limit headwords within @p maxDistance edits of @p key, closest first.
+     */
+    virtual QStringList findFuzzy(const QString &key, int maxDistance, int limit) const = 0;
+    /**
+     * Visits all headwords of the loaded dictionary in ascending order with their ordinals until @p visit returns
+     * @c false. Safe to call from any thread.
+     * @return @c false if the dictionary is not loaded, @c true otherwise.
+     */
+    bool enumerateKeys(const std::function<bool(const QString &, quint32)> &visit) const;
+    /**
+     * Looks up @p hits, which have been resolved already (see `UnifiedIndex`), instead of the query text.
+     */
+    void queryHits(const QList<LocalDictHit> &hits, int queryId);
+
 Q_SIGNALS:
     void sourceChanged(const QString &source);
     void sortedChanged(bool sorted);
     void loadedChanged(bool loaded);
+    void loadingChanged(bool loading);
+    void progressChanged(qreal progress);
+    void buildThreadsChanged(int buildThreads);
+    /**
+     * Emitted after all results of query @p queryId have been emitted, unless the lookup was aborted.
+     */
+    void queryFinished(int queryId);
 
 protected:
     bool doSetEnabled(bool enabled) override;
+    /**
+     * Drops pending jobs, waits for the running ones and unloads the dictionary. Must be called by the destructors of
+     * subclasses, since jobs call their virtual functions.
+     */
+    void shutdown();
+    /**
+     * Queries arriving before the dictionary is loaded are skipped, except for the last one while loading, which is
+     * queried again once loaded.
+     * @return @c true if @p text can't be queried now, @c false otherwise.
+     */
+    bool deferQuery(const QString &text, int queryId);
+    /**
+     * @return @c true if a newer query than @p queryId has been issued, so that work for it can be aborted.
+     */
+    bool isStale(int queryId) const;
+    /**
+     * Reports loading progress, may be called from the loading thread.
+     */
+    void reportProgress(qreal progress);
+    /**
+     * Emits `queryResult` for every definition of @p key. Runs on the lookup thread while the dictionary is loaded.
+     * @param ordinal ordinal of @p key in the index, -1 if unknown.
+     * @return @c true if successful, @c false otherwise.
+     */
+    virtual bool lookupKey(const QString &key, qint64 ordinal, int queryId) = 0;
+    virtual void forEachKey(const std::function<bool(const QString &, quint32)> &visit) const = 0;
     virtual bool loadDict() = 0;
     virtual bool unloadDict() = 0;
     bool loadOrBuildIndex();
     bool needBuildIndex();
+    /**
+     * @return path of the index file of @p dictFileName in the cache dir.
+     */
+    static QString indexFileName(const QString &dictFileName);
     virtual bool buildIndex() = 0;
     virtual bool loadIndex() = 0;
     virtual bool unloadIndex() = 0;
+    template<typename Index>
+    bool saveIndex(Index *index);
+    template<typename Key, typename Entry, typename Make>
+    std::vector<std::pair<Key, Entry>> makeEntries(size_t count, bool needSort, Make make);
+    /**
+     * @param candidates normalized keys of a query, see `QuickDict::queryKeys`.
+     * @return the first of @p candidates if it is a headword, otherwise the other candidates which are headwords, or
+     * the closest headwords if there are none.
+     */
+    QStringList lookupKeys(const QStringList &candidates) const;
 
+    // owned by the loading thread
     QString m_dictFileName;
     QString m_indexFileName;
+    bool m_dictLoaded = false;
+
+    QString m_source;
     bool m_sorted = false; // defaults to unsorted
     bool m_loaded = false;
+    bool m_loading = false;
+    qreal m_progress = 0;
+    int m_buildThreads = 0;
+
+private:
+    void onQuery(const QString &text, int queryId);
+    void startLookup(const std::function<QList<LocalDictHit>()> &resolve, int queryId);
+    void load();
+    void unload();
+    void finishLoading(int generation, bool loaded);
+    void setLoading(bool loading);
+    void setProgress(qreal progress);
+
+    QThreadPool m_loadingPool; // runs one job at a time, in order
+    QThreadPool m_lookupPool;  // ditto, a newer query drops the queued lookups
+    mutable QReadWriteLock m_lock; // held for writing by loading jobs and for reading by lookups
+    int m_generation = 0;      // bumped whenever a job is scheduled, so that stale results are dropped
+    QString m_pendingQuery;
+    int m_pendingQueryId = 0;
 };
 
+/**
+ * Creates @p count entries by calling `make(i, key, entry)` for each of them, and sorts them by key if @p needSort.
+ * The entries are split into one chunk per thread, each chunk is made and sorted on its own thread, and then the
+ * sorted chunks are merged pairwise in parallel. The order of entries with the same key is kept.
+ */
+template<typename Key, typename Entry, typename Make>
+std::vector<std::pair<Key, Entry>> LocalDict::makeEntries(size_t count, bool needSort, Make make)
+{
+    using Clock = std::chrono::steady_clock;
+    using Milliseconds = std::chrono::duration<double, std::milli>;
+    const size_t minChunkSize = 4096; // smaller chunks aren't worth a thread
+    size_t threads = m_buildThreads > 0 ? m_buildThreads : std::max(1U, std::thread::hardware_concurrency());
+    size_t chunks = std::max<size_t>(1, std::min(threads, count / minChunkSize));
+    std::vector<size_t> bounds(chunks + 1);
+    for (size_t i = 0; i <= chunks; ++i)
+        bounds[i] = count * i / chunks;
+    std::vector<std::pair<Key, Entry>> entries(count);
+    auto less = [](const auto &lhs, const auto &rhs) { return lhs.first < rhs.first; };
+
+    Clock::time_point start = Clock::now();
+    std::vector<double> busy(chunks); // time spent by each thread, in ms
+    parallel_for(chunks, [&](size_t chunk) {
+        Clock::time_point begin = Clock::now();
+        for (size_t i = bounds[chunk]; i < bounds[chunk + 1]; ++i)
+            make(i, entries[i].first, entries[i].second);
+        if (needSort)
+            std::stable_sort(entries.begin() + bounds[chunk], entries.begin() + bounds[chunk + 1], less);
+        busy[chunk] = Milliseconds(Clock::now() - begin).count();
+    });
+    Clock::time_point made = Clock::now();
+    for (size_t width = 1; needSort && width < chunks; width *= 2) {
+        // every round merges neighbouring runs of `width` chunks
+        size_t merges = (chunks - width + 2 * width - 1) / (2 * width);
+        std::vector<double> mergeBusy(merges);
+        parallel_for(merges, [&](size_t merge) {
+            Clock::time_point begin = Clock::now();
+            size_t first = merge * 2 * width;
+            std::inplace_merge(entries.begin() + bounds[first],
+                               entries.begin() + bounds[first + width],
+                               entries.begin() + bounds[std::min(first + 2 * width, chunks)],
+                               less);
+            mergeBusy[merge] = Milliseconds(Clock::now() - begin).count();
+        });
+        busy.insert(busy.end(), mergeBusy.begin(), mergeBusy.end());
+    }
+    Clock::time_point end = Clock::now();
+
+    // average number of busy threads, i.e. the time all threads were busy over the elapsed time, not a speedup over a
+    // serial build, which would be lower since threads compete for memory bandwidth
+    double elapsed = Milliseconds(end - start).count();
+    double total = 0;
+    for (double t : busy)
+        total += t;
+    qCInfo(qdDict) << "Dict:" << name() << "entries:" << count << "threads:" << chunks
+                   << "make/sort:" << Milliseconds(made - start).count() << "ms"
+                   << "merge:" << Milliseconds(end - made).count() << "ms"
+                   << "parallelism:" << (elapsed > 0 ? total / elapsed : 1.0);
+    return entries;
+}
+
+/**
+ * Writes @p index to a temporary file and then replaces the index file with it, so that other processes which have
+ * the old index file mapped are not affected.
+ * @return @c true if successful, @c false otherwise, with a warning logged.
+ */
+template<typename Index>
+bool LocalDict::saveIndex(Index *index)
+{
+    QString tempFileName = m_indexFileName + ".tmp";
+    FILE *indexFile = fopen_unicode(tempFileName.toStdString().c_str(), "wb+");
+    if (nullptr == indexFile) {
+        qCWarning(qdDict) << "Dict:" << name() << "error: Failed to open file" << tempFileName;
+        return false;
+    }
+    qCDebug(qdDict) << "Dict:" << name() << "status: Saving indexes...";
+    size_t bytes = index->serialize(indexFile);
+    fclose(indexFile);
+    if (bytes == 0) {
+        qCWarning(qdDict) << "Dict:" << name() << "error: Failed to write file" << tempFileName;
+        QFile::remove(tempFileName);
+        return false;
+    }
+    QFile::remove(m_indexFileName);
+    if (!QFile::rename(tempFileName, m_indexFileName)) {
+        qCWarning(qdDict) << "Dict:" << name() << "error: Failed to rename file" << tempFileName;
+        QFile::remove(tempFileName);
+        return false;
+    }
+    qCDebug(qdDict) << "Dict:" << name() << "status: Saving indexes finished..." << "bytes:" << bytes;
+    return true;
+}
+
 #endif // LOCALDICT_H
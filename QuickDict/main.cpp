@@ -1,5 +1,7 @@
+#include "asynclogger.h"
 #include "clipboardmonitor.h"
 #include "configcenter.h"
+#include "dictdfiledict.h"
 #include "dictservice.h"
 #ifdef ENABLE_QHOTKEY
 #include "hotkey.h"
@@ -11,6 +13,8 @@
 #include "ocrengine.h"
 #endif
 #include "quickdict.h"
+#include "stardictdict.h"
+#include "trace.h"
 
 #if ENABLE_KWIN_BLUR
 #include <KWindowEffects>
@@ -20,6 +24,7 @@
 #include <QDir>
 #include <QQmlApplicationEngine>
 #include <QQmlContext>
+#include <QQuickWindow>
 #include <QStandardPaths>
 #include <QTimer>
 #include <QWindow>
@@ -28,17 +33,28 @@
 #include <Windows.h>
 #endif
 
-static QFile logFile;
+static AsyncLogger logger;
 static QtMessageHandler defaultMessageHandler;
 static bool debugFlag;
 
 void messageHandler(QtMsgType type, const QMessageLogContext &context, const QString &message)
 {
-    static QMutex mutex;
-    QMutexLocker lock(&mutex);
-
-    logFile.write(qFormatLogMessage(type, context, message).toUtf8().append('\n'));
-    logFile.flush();
+    QString line = qFormatLogMessage(type, context, message);
+    if (type == QtFatalMsg) {
+        // the process aborts right after, so wait until the message is on disk, a full ring buffer is drained by
+        // flushing unless the writer thread is gone or is the one failing
+        bool logged = logger.log(line);
+        for (int retries = 0; !logged && retries < 3 && logger.canFlush(); ++retries) {
+            logger.flush();
+            logged = logger.log(line);
+        }
+        if (logged && logger.canFlush())
+            logger.flush();
+        else if (!debugFlag)
+            fprintf(stderr, "%s\n", qPrintable(line)); // the terminal is the last resort
+    } else {
+        logger.log(line);
+    }
 
     if (debugFlag)
         defaultMessageHandler(type, context, message); // output to the terminal
@@ -60,6 +76,8 @@ int main(int argc, char *argv[])
     qmlRegisterType<DictService>("com.quickdict.components", 1, 0, "Dict");
     qmlRegisterType<MobiDict>("com.quickdict.components", 1, 0, "MobiDict");
     qmlRegisterType<MdxDict>("com.quickdict.components", 1, 0, "MdxDict");
+    qmlRegisterType<StarDictDict>("com.quickdict.components", 1, 0, "StarDictDict");
+    qmlRegisterType<DictdFileDict>("com.quickdict.components", 1, 0, "DictdFileDict");
 #ifdef ENABLE_QHOTKEY
     qmlRegisterType<Hotkey>("com.quickdict.components", 1, 0, "Hotkey");
 #endif
@@ -85,6 +103,7 @@ int main(int argc, char *argv[])
     parser.addHelpOption();
     parser.addVersionOption();
     parser.addOption({{"d", "debug"}, QObject::tr("Print log messages.")});
+    parser.addOption({"trace", QObject::tr("Trace queries, the trace is saved to trace.json in the log dir at exit.")});
     parser.process(app);
 
     debugFlag = parser.isSet("debug");
@@ -104,14 +123,15 @@ int main(int argc, char *argv[])
     if (!debugFlag)
         QLoggingCategory::setFilterRules("qd.*.debug=false");
 
-    logFile.setFileName(QDir(QuickDict::logDirPath()).filePath("log"));
-    if (!logFile.open(QIODevice::Append | QIODevice::Text))
-        qCWarning(qd) << "Cannot open file:" << logFile.fileName();
+    QString logFileName = QDir(QuickDict::logDirPath()).filePath("log");
+    if (!logger.open(logFileName))
+        qCWarning(qd) << "Cannot open file:" << logFileName;
     else
         defaultMessageHandler = qInstallMessageHandler(messageHandler);
 
     QuickDict::createInstance();
     QuickDict *quickDict = QuickDict::instance();
+    quickDict->setTracing(parser.isSet("trace"));
 
     ConfigCenter configCenter(QDir(QuickDict::configDirPath()).filePath("settings.ini"));
     quickDict->setConfigCenter(&configCenter);
@@ -165,14 +185,38 @@ int main(int argc, char *argv[])
     // window->setProperty("color", "transparent");
     KWindowEffects::enableBlurBehind(window);
 #endif
+    if (QQuickWindow *quickWindow = qobject_cast<QQuickWindow *>(window)) {
+        // a frame is traced from syncing the scene graph to swapping buffers, both on the render thread
+        static thread_local qint64 frameBegin = -1;
+        QObject::connect(
+            quickWindow,
+            &QQuickWindow::beforeSynchronizing,
+            quickWindow,
+            []() { frameBegin = Trace::isEnabled() ? Trace::now() : -1; },
+            Qt::DirectConnection);
+        QObject::connect(
+            quickWindow,
+            &QQuickWindow::frameSwapped,
+            quickWindow,
+            []() {
+                if (frameBegin >= 0)
+                    Trace::complete(qd(), "render", frameBegin, Trace::now());
+            },
+            Qt::DirectConnection);
+    }
     window->show();
 
     int ret = app.exec();
 
+    quickDict->setTracing(false);
+
 #ifdef ENABLE_TESSERACT
     ocrEngine.stop();
 #endif
-    logFile.close();
+    // messages after this go to the terminal only
+    if (logger.isOpen())
+        qInstallMessageHandler(defaultMessageHandler);
+    logger.close();
 
     return ret;
 }
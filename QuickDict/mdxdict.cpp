@@ -1,121 +1,112 @@
 #include "mdxdict.h"
 #include "quickdict.h"
+#include "trace.h"
 #include "utils.h"
 
-#ifdef ENABLE_OPENCC
-#include <opencc/opencc.h>
-#endif
-#ifdef ENABLE_HUNSPELL
-#include <hunspell/hunspell.hxx>
-#endif
-#ifdef ENABLE_UNAC
-#include <unac/unac.h>
-#endif
-
 #include <QDir>
 #include <QFileInfo>
 
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#endif
+
 MdxDict::MdxDict(QObject *parent)
     : LocalDict(parent)
 {
     m_dictIndex = new MdxIndex;
-
-    connect(this, &MdxDict::query, this, &MdxDict::onQuery);
+    m_blockCache.setMaxCost(16 * 1024 * 1024);
 }
 
 MdxDict::~MdxDict()
 {
-    if (loaded()) {
-        unloadDict();
-        unloadIndex();
-    }
+    shutdown();
     delete m_dictIndex;
 }
 
-void MdxDict::onQuery(const QString &text)
+bool MdxDict::lookupKey(const QString &key, qint64 ordinal, int queryId)
 {
-    QString normalized = text.trimmed().toLower();
-    QStringList textList;
-#ifdef ENABLE_HUNSPELL
-    Hunspell *hunspell = QuickDict::instance()->hunspell();
-    if (!hunspell->spell(normalized.toStdString())) {
-        std::vector<std::string> l = hunspell->suggest(normalized.toStdString());
-        for (const auto &s : l)
-            textList.append(QString::fromStdString(s));
+    std::vector<MdxEntry> values;
+    {
+        TraceSpan span(qdDict(), "findEntry", key);
+        values = ordinal < 0 ? m_dictIndex->findEntry(key) : m_dictIndex->valuesAt(ordinal);
     }
-    if (!textList.contains(normalized))
-        textList.prepend(normalized);
-#else
-    textList << normalized;
-#endif
-
-    for (QString text_ : qAsConst(textList)) {
-#ifdef ENABLE_OPENCC
-        text_ = QString::fromStdString(QuickDict::instance()->openccConverter()->Convert(text_.toStdString()));
-#endif
-#ifdef ENABLE_UNAC
-        std::string utf8Text = text_.toStdString();
-        char *unaccented = nullptr;
-        size_t len;
-        if (unac_string("UTF8", utf8Text.c_str(), utf8Text.size(), &unaccented, &len) != -1) {
-            text_ = QString::fromUtf8(unaccented, len);
-            free(unaccented);
-        }
-#endif
-        auto node = m_dictIndex->findEntry(text_);
-        if (!node) {
-            qCDebug(qdDict) << "Dict:" << name() << "query: No entry for" << text_;
-            return;
+    if (values.empty())
+        return true;
+    qCDebug(qdDict) << "Dict:" << name() << "query:" << key << "count:" << values.size();
+    for (const MdxEntry &entry : values) {
+        uint64_t block = std::get<0>(entry);
+        uint64_t relative_offset = std::get<1>(entry);
+        uint64_t length = std::get<2>(entry);
+        QByteArray data;
+        if (!recordBlock(block, data))
+            return false;
+        if (relative_offset + length > static_cast<uint64_t>(data.size())) {
+            qCWarning(qdDict) << "Dict:" << name() << "error: Invalid record offset" << relative_offset;
+            continue;
         }
-        qCDebug(qdDict) << "Dict:" << name() << "query:" << text_ << "count:" << node->_value.size();
-        for (const MdxEntry &entry : node->_value) {
-            uint64_t block = std::get<0>(entry);
-            uint64_t relative_offset = std::get<1>(entry);
-            uint64_t length = std::get<2>(entry);
-            unsigned char *block_compressed = (unsigned char *) malloc(m_mdxData->record.compressed_block_sizes[block]);
-            if (!block_compressed) {
-                qCWarning(qdDict) << "Dict:" << name() << "error: Failed to allocate memory";
-                return;
-            }
-            if (fseek(m_dictFile, m_mdxData->record.record_block_offsets[block], SEEK_SET) == -1) {
-                qCWarning(qdDict) << "Dict:" << name() << "error: Failed to seek file";
-                free(block_compressed);
-                return;
-            }
-            if (fread(block_compressed, 1, m_mdxData->record.compressed_block_sizes[block], m_dictFile)
-                != m_mdxData->record.compressed_block_sizes[block]) {
-                qCWarning(qdDict) << "Dict:" << name() << "error: Failed to read file";
-                free(block_compressed);
-                return;
-            }
-            unsigned char *block_uncompressed = (unsigned char *) malloc(
-                m_mdxData->record.uncompressed_block_sizes[block]);
-            if (!block_uncompressed) {
-                qCWarning(qdDict) << "Dict:" << name() << "error: Failed to allocate memory";
-                free(block_compressed);
-                return;
-            }
-            MDX_RET ret = mdx_uncompress(block_compressed,
-                                         m_mdxData->record.compressed_block_sizes[block],
-                                         &block_uncompressed,
-                                         &m_mdxData->record.uncompressed_block_sizes[block]);
-            if (ret != MDX_NO_ERROR) {
-                qCWarning(qdDict) << "Dict:" << name() << "error: Failed to uncompress data";
-                free(block_compressed);
-                free(block_uncompressed);
-                return;
-            }
 
-            QString definition = QString::fromUtf8(reinterpret_cast<const char *>(block_uncompressed + relative_offset),
-                                                   length);
-            free(block_compressed);
-            free(block_uncompressed);
-            if (!m_styleSheet.isEmpty())
-                definition = QString("<style>%1</style>%2").arg(m_styleSheet, definition);
-            QJsonObject result{{"engine", name()}, {"text", text_}, {"result", definition}, {"type", "lookup"}};
-            emit queryResult(result);
-        }
+        QString definition = QString::fromUtf8(data.constData() + relative_offset, length);
+        if (!m_styleSheet.isEmpty())
+            definition = QString("<style>%1</style>%2").arg(m_styleSheet, definition);
+        QJsonObject result{
+            {"engine", name()}, {"text", key}, {"result", definition}, {"type", "lookup"}, {"id", queryId}};
+        emit queryResult(result);
     }
+
+    return true;
+}
+
+void MdxDict::forEachKey(const std::function<bool(const QString &, quint32)> &visit) const
+{
+    m_dictIndex->forEachKey([&visit](const MdxKey &key, size_t ordinal) { return visit(key, ordinal); });
+}
+
+int MdxDict::blockCacheSize() const
+{
+    QMutexLocker locker(&m_blockCacheMutex);
+    return m_blockCache.maxCost();
+}
+
+void MdxDict::setBlockCacheSize(int blockCacheSize)
+{
+    QMutexLocker locker(&m_blockCacheMutex);
+    if (blockCacheSize == m_blockCache.maxCost())
+        return;
+    m_blockCache.setMaxCost(blockCacheSize);
+    locker.unlock();
+    emit blockCacheSizeChanged(blockCacheSize);
+}
+
+QVariantMap MdxDict::blockCacheStats() const
+{
+    QMutexLocker locker(&m_blockCacheMutex);
+    quint64 lookups = m_blockCacheHits + m_blockCacheMisses;
+    return QVariantMap{{"hits", m_blockCacheHits},
+                       {"misses", m_blockCacheMisses},
+                       {"hitRate", lookups ? qreal(m_blockCacheHits) / lookups : 0.0},
+                       {"blocks", m_blockCache.count()},
+                       {"bytes", m_blockCache.totalCost()}};
+}
+
+QStringList MdxDict::findPrefix(const QString &prefix, int limit) const
+{
+    QStringList l;
+    for (const MdxKey &key : m_dictIndex->findPrefix(prefix, limit))
+        l.append(key);
+    return l;
+}
+
+bool MdxDict::containsKey(const QString &key) const
+{
+    return m_dictIndex->contains(key);
+}
+
+QStringList MdxDict::findFuzzy(const QString &key, int maxDistance, int limit) const
+{
+    QStringList l;
+    for (const auto &match : m_dictIndex->findFuzzy(key, maxDistance, limit))
+        l.append(match.first);
+    return l;
 }
 
 bool MdxDict::loadDict()
@@ -133,6 +124,7 @@ bool MdxDict::loadDict()
     if (nullptr == m_dictFile) {
         qCWarning(qdDict) << "Dict:" << name() << "error: Failed to open file" << m_dictFileName;
         delete m_mdxData;
+        m_mdxData = nullptr;
         return false;
     }
 
@@ -141,6 +133,9 @@ bool MdxDict::loadDict()
     if (ret != MDX_NO_ERROR) {
         qCWarning(qdDict) << "Dict:" << name() << "error:" << mdx_error_string(ret);
         delete m_mdxData;
+        m_mdxData = nullptr;
+        fclose(m_dictFile);
+        m_dictFile = nullptr;
         return false;
     }
 
@@ -148,8 +143,28 @@ bool MdxDict::loadDict()
     if (ret != MDX_NO_ERROR) {
         qCWarning(qdDict) << "Dict:" << name() << "error:" << mdx_error_string(ret);
         delete m_mdxData;
+        m_mdxData = nullptr;
+        fclose(m_dictFile);
+        m_dictFile = nullptr;
+        return false;
+    }
+
+    m_mappedFile.setFileName(m_dictFileName);
+    m_mappedSize = m_mappedFile.size();
+    if (!m_mappedFile.open(QIODevice::ReadOnly) || m_mappedSize <= 0
+        || !(m_mappedData = m_mappedFile.map(0, m_mappedSize))) {
+        qCWarning(qdDict) << "Dict:" << name() << "error: Failed to map file" << m_dictFileName;
+        m_mappedFile.close();
+        mdx_free(m_mdxData);
+        m_mdxData = nullptr;
+        fclose(m_dictFile);
+        m_dictFile = nullptr;
         return false;
     }
+#ifdef Q_OS_UNIX
+    // lookups jump between record blocks, read-ahead would only waste page cache
+    madvise(const_cast<uchar *>(m_mappedData), m_mappedSize, MADV_RANDOM);
+#endif
 
     qCDebug(qdDict) << "Dict:" << name() << "entries:" << m_mdxData->record.num_total_entries;
 
@@ -158,11 +173,65 @@ bool MdxDict::loadDict()
 
 bool MdxDict::unloadDict()
 {
+    m_blockCacheMutex.lock();
+    m_blockCache.clear();
+    m_blockCacheMutex.unlock();
+    if (m_mappedData) {
+        m_mappedFile.unmap(const_cast<uchar *>(m_mappedData));
+        m_mappedData = nullptr;
+        m_mappedSize = 0;
+    }
+    m_mappedFile.close();
+    if (m_dictFile) {
+        fclose(m_dictFile);
+        m_dictFile = nullptr;
+    }
     mdx_free(m_mdxData);
     m_mdxData = nullptr;
     return true;
 }
 
+bool MdxDict::recordBlock(uint64_t block, QByteArray &data)
+{
+    QMutexLocker locker(&m_blockCacheMutex);
+    if (QByteArray *cached = m_blockCache.object(block)) {
+        ++m_blockCacheHits;
+        data = *cached;
+        return true;
+    }
+    ++m_blockCacheMisses;
+    locker.unlock();
+
+    uint64_t offset = m_mdxData->record.record_block_offsets[block];
+    uint64_t compressed_size = m_mdxData->record.compressed_block_sizes[block];
+    if (offset > static_cast<uint64_t>(m_mappedSize) || compressed_size > m_mappedSize - offset) {
+        qCWarning(qdDict) << "Dict:" << name() << "error: Invalid record block" << block;
+        return false;
+    }
+    // decompress straight from the mapping, libmdx doesn't modify its input
+    unsigned char *block_compressed = const_cast<unsigned char *>(m_mappedData + offset);
+    auto uncompressed_size = m_mdxData->record.uncompressed_block_sizes[block];
+    unsigned char *block_uncompressed = (unsigned char *) malloc(uncompressed_size);
+    if (!block_uncompressed) {
+        qCWarning(qdDict) << "Dict:" << name() << "error: Failed to allocate memory";
+        return false;
+    }
+    TraceSpan span(qdDict(), "mdx_uncompress");
+    MDX_RET ret = mdx_uncompress(block_compressed, compressed_size, &block_uncompressed, &uncompressed_size);
+    if (ret != MDX_NO_ERROR) {
+        qCWarning(qdDict) << "Dict:" << name() << "error: Failed to uncompress data";
+        free(block_uncompressed);
+        return false;
+    }
+
+    data = QByteArray(reinterpret_cast<const char *>(block_uncompressed), uncompressed_size);
+    free(block_uncompressed);
+    // a block larger than the whole cache is not cached, `insert` deletes it right away
+    locker.relock();
+    m_blockCache.insert(block, new QByteArray(data), data.size());
+    return true;
+}
+
 bool MdxDict::buildIndex()
 {
     qCDebug(qdDict) << "Dict:" << name() << "status: Building indexes...";
@@ -173,15 +242,10 @@ bool MdxDict::buildIndex()
         qCWarning(qdDict) << "Dict:" << name() << "error:" << mdx_error_string(ret);
         return false;
     }
+    reportProgress(0.2);
 
-    std::vector<std::pair<MdxKey, MdxEntry>> entries;
-    bool needSort = !sorted();
-#if defined(ENABLE_OPENCC) || defined(ENABLE_UNAC)
-    needSort = true;
-#endif
-    if (needSort)
-        entries.reserve(m_mdxData->record.num_total_entries);
-
+    std::vector<MdxEntry> records;
+    records.reserve(m_mdxData->record.num_total_entries);
     size_t accumulated_length = 0;
     size_t entry_count = 0;
     for (size_t block = 0; block < m_mdxData->record.num_blocks; ++block) {
@@ -197,57 +261,44 @@ bool MdxDict::buildIndex()
             } else {
                 length = m_mdxData->record.uncompressed_block_sizes[block] - (relative_offset + 8 + 1);
             }
-            // FIXME: encoding conversion
-            char *keyword = (char *) m_mdxData->keyword.keywords[entry_count];
-            QString text;
-#ifdef ENABLE_OPENCC
-            text = QString::fromStdString(QuickDict::instance()->openccConverter()->Convert(keyword));
-#else
-            text = QString::fromUtf8(keyword);
-#endif
-#ifdef ENABLE_UNAC
-            std::string utf8Text = text.toStdString();
-            char *unaccented = nullptr;
-            size_t len;
-            if (unac_string("UTF8", utf8Text.c_str(), utf8Text.size(), &unaccented, &len) != -1) {
-                text = QString::fromUtf8(unaccented, len);
-                free(unaccented);
-            }
-#endif
-            text = text.toLower();
-            MdxEntry entry{block, relative_offset, length};
-            if (needSort) {
-                entries.emplace_back(text, entry);
-            } else {
-                if (!m_dictIndex->addEntry(text, entry)) {
-                    qCWarning(qdDict) << "Dict:" << name() << "error: Failed to build indexes";
-                    return false;
-                }
-            }
+            records.emplace_back(block, relative_offset, length);
             ++entry_count;
         }
         accumulated_length += m_mdxData->record.uncompressed_block_sizes[block];
     }
 
-    if (needSort) {
-        std::sort(entries.begin(), entries.end(), [](const auto &lhs, const auto &rhs) {
-            return lhs.first < rhs.first;
-        });
-        for (const auto &entry : entries)
-            m_dictIndex->addEntry(entry.first, entry.second);
-        entries.clear();
+    bool needSort = !sorted();
+#if defined(ENABLE_OPENCC) || defined(ENABLE_UNAC)
+    needSort = true;
+#endif
+    auto make = [this, &records](size_t i, MdxKey &key, MdxEntry &entry) {
+        // FIXME: encoding conversion
+        const char *keyword = (const char *) m_mdxData->keyword.keywords[i];
+        key = QuickDict::instance()->normalizeKey(std::string(keyword));
+        entry = records[i];
+    };
+    auto entries = makeEntries<MdxKey, MdxEntry>(records.size(), needSort, make);
+    records = std::vector<MdxEntry>();
+    reportProgress(0.5);
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (!m_dictIndex->addEntry(entries[i].first, entries[i].second)) {
+            qCWarning(qdDict) << "Dict:" << name() << "error: Failed to build indexes";
+            m_dictIndex->clear();
+            return false;
+        }
+        if (i % 65536 == 0)
+            reportProgress(0.5 + 0.4 * i / entries.size());
     }
+    entries = decltype(entries)();
 
-    m_indexFile = fopen_unicode(m_indexFileName.toStdString().c_str(), "wb+");
-    if (nullptr == m_indexFile) {
-        qCWarning(qdDict) << "Dict:" << name() << "error: Failed to open file" << m_indexFileName;
-        return false;
-    }
-    qCDebug(qdDict) << "Dict:" << name() << "status: Saving indexes...";
-    m_dictIndex->serialize(m_indexFile);
-    qCDebug(qdDict) << "Dict:" << name() << "status: Saving indexes finished...";
-    fclose(m_indexFile);
+    qCDebug(qdDict) << "Dict:" << name() << "status: Minimizing indexes...";
+    m_dictIndex->finish();
+    reportProgress(0.95);
+    qCInfo(qdDict) << "Dict:" << name() << "keys:" << m_dictIndex->keyCount()
+                   << "nodes:" << m_dictIndex->trieNodeCount() << "->" << m_dictIndex->nodeCount();
 
+    // without a saved index, the one in memory still serves until the next start
+    saveIndex(m_dictIndex);
     return true;
 }
 
@@ -255,13 +306,11 @@ bool MdxDict::loadIndex()
 {
     qCDebug(qdDict) << "Dict:" << name() << "status: Loading indexes...";
 
-    m_indexFile = fopen_unicode(m_indexFileName.toStdString().c_str(), "rb");
-    if (nullptr == m_indexFile) {
-        qCWarning(qdDict) << "Dict:" << name() << "error: Failed to open file" << m_indexFileName;
+    if (!m_dictIndex->map(m_indexFileName)) {
+        qCWarning(qdDict) << "Dict:" << name() << "error: Failed to map index file" << m_indexFileName;
         return false;
     }
-    m_dictIndex->deserialize(m_indexFile);
-    fclose(m_indexFile);
+    qCDebug(qdDict) << "Dict:" << name() << "keys:" << m_dictIndex->keyCount() << "bytes:" << m_dictIndex->byteCount();
 
     return true;
 }
@@ -4,6 +4,9 @@
 #include "dictindex.h"
 #include "localdict.h"
 #include <libmdx/mdx.h>
+#include <QCache>
+#include <QMutex>
+#include <QVariantMap>
 
 using MdxKey = QString;
 using MdxEntry = std::tuple<uint64_t, uint64_t, uint64_t>;
@@ -12,13 +15,32 @@ using MdxIndex = DictIndex<MdxKey, MdxEntry>;
 class MdxDict : public LocalDict
 {
     Q_OBJECT
+    Q_PROPERTY(int blockCacheSize READ blockCacheSize WRITE setBlockCacheSize NOTIFY blockCacheSizeChanged)
 
 public:
     explicit MdxDict(QObject *parent = nullptr);
     virtual ~MdxDict();
 
+    /**
+     * @return maximum bytes of decompressed record blocks kept in memory.
+     */
+    int blockCacheSize() const;
+    void setBlockCacheSize(int blockCacheSize);
+    /**
+     * @return hits, misses, hit rate and current usage of the record block cache.
+     */
+    Q_INVOKABLE QVariantMap blockCacheStats() const;
+
+    QStringList findPrefix(const QString &prefix, int limit) const override;
+    bool containsKey(const QString &key) const override;
+    QStringList findFuzzy(const QString &key, int maxDistance, int limit) const override;
+
+Q_SIGNALS:
+    void blockCacheSizeChanged(int blockCacheSize);
+
 protected:
-    void onQuery(const QString &text);
+    bool lookupKey(const QString &key, qint64 ordinal, int queryId) override;
+    void forEachKey(const std::function<bool(const QString &, quint32)> &visit) const override;
     bool loadDict() override;
     bool unloadDict() override;
     bool loadOrBuildIndex();
@@ -26,12 +48,23 @@ protected:
     bool buildIndex() override;
     bool loadIndex() override;
     bool unloadIndex() override;
+    /**
+     * Reads and decompresses record block @p block unless it is cached.
+     * @return @c true if successful, @c false otherwise.
+     */
+    bool recordBlock(uint64_t block, QByteArray &data);
 
     QString m_styleSheet;
-    FILE *m_dictFile = nullptr;
-    FILE *m_indexFile = nullptr;
+    FILE *m_dictFile = nullptr; // only used to parse the headers and build indexes
+    QFile m_mappedFile;
+    const uchar *m_mappedData = nullptr; // the whole file, records are decompressed from it
+    qint64 m_mappedSize = 0;
     MdxIndex *m_dictIndex = nullptr;
     mdx_data *m_mdxData = nullptr;
+    QCache<uint64_t, QByteArray> m_blockCache; // cost is the size of the block in bytes
+    mutable QMutex m_blockCacheMutex;          // guards the cache and its counters
+    quint64 m_blockCacheHits = 0;
+    quint64 m_blockCacheMisses = 0;
 };
 
 #endif // MDXDICT_H
@@ -1,31 +1,17 @@
 #include "mobidict.h"
 #include "quickdict.h"
+#include "trace.h"
 #include "utils.h"
 
-#ifdef ENABLE_OPENCC
-#include <opencc/opencc.h>
-#endif
-#ifdef ENABLE_HUNSPELL
-#include <hunspell/hunspell.hxx>
-#endif
-#ifdef ENABLE_UNAC
-#include <unac/unac.h>
-#endif
-
 MobiDict::MobiDict(QObject *parent)
     : LocalDict(parent)
 {
     m_dictIndex = new MobiIndex;
-
-    connect(this, &MobiDict::query, this, &MobiDict::onQuery);
 }
 
 MobiDict::~MobiDict()
 {
-    if (loaded()) {
-        unloadDict();
-        unloadIndex();
-    }
+    shutdown();
     delete m_dictIndex;
 }
 
@@ -37,50 +23,52 @@ void MobiDict::setSerialNumber(const QString &serialNumber)
     emit serialNumberChanged(m_serialNumber);
 }
 
-void MobiDict::onQuery(const QString &text)
+bool MobiDict::lookupKey(const QString &key, qint64 ordinal, int queryId)
 {
-    QString normalized = text.trimmed().toLower();
-    QStringList textList;
-#ifdef ENABLE_HUNSPELL
-    Hunspell *hunspell = QuickDict::instance()->hunspell();
-    if (!hunspell->spell(normalized.toStdString())) {
-        std::vector<std::string> l = hunspell->suggest(normalized.toStdString());
-        for (const auto &s : l)
-            textList.append(QString::fromStdString(s));
+    std::vector<MobiEntry> values;
+    {
+        TraceSpan span(qdDict(), "findEntry", key);
+        values = ordinal < 0 ? m_dictIndex->findEntry(key) : m_dictIndex->valuesAt(ordinal);
+    }
+    if (values.empty())
+        return true;
+    qCDebug(qdDict) << "Dict:" << name() << "query:" << key << "count:" << values.size();
+    for (const MobiEntry &entry : values) {
+        QString definition = QString::fromUtf8(reinterpret_cast<const char *>(m_mobiRawml->flow->data + entry.first),
+                                               entry.second);
+
+        QJsonObject result{
+            {"engine", name()}, {"text", key}, {"result", definition}, {"type", "lookup"}, {"id", queryId}};
+        emit queryResult(result);
     }
-    if (!textList.contains(normalized))
-        textList.prepend(normalized);
-#else
-    textList << normalized;
-#endif
 
-    for (QString text_ : qAsConst(textList)) {
-#ifdef ENABLE_OPENCC
-        text_ = QString::fromStdString(QuickDict::instance()->openccConverter()->Convert(text_.toStdString()));
-#endif
-#ifdef ENABLE_UNAC
-        std::string utf8Text = text_.toStdString();
-        char *unaccented = nullptr;
-        size_t len;
-        if (unac_string("UTF8", utf8Text.c_str(), utf8Text.size(), &unaccented, &len) != -1) {
-            text_ = QString::fromUtf8(unaccented, len);
-            free(unaccented);
-        }
-#endif
-        auto node = m_dictIndex->findEntry(text_);
-        if (!node) {
-            qCDebug(qdDict) << "Dict:" << name() << "query: No entry for" << text_;
-            return;
-        }
-        qCDebug(qdDict) << "Dict:" << name() << "query:" << text_ << "count:" << node->_value.size();
-        for (const MobiEntry &entry : node->_value) {
-            QString definition = QString::fromUtf8(reinterpret_cast<const char *>(m_mobiRawml->flow->data + entry.first),
-                                                   entry.second);
+    return true;
+}
 
-            QJsonObject result{{"engine", name()}, {"text", text_}, {"result", definition}, {"type", "lookup"}};
-            emit queryResult(result);
-        }
-    }
+void MobiDict::forEachKey(const std::function<bool(const QString &, quint32)> &visit) const
+{
+    m_dictIndex->forEachKey([&visit](const MobiKey &key, size_t ordinal) { return visit(key, ordinal); });
+}
+
+QStringList MobiDict::findPrefix(const QString &prefix, int limit) const
+{
+    QStringList l;
+    for (const MobiKey &key : m_dictIndex->findPrefix(prefix, limit))
+        l.append(key);
+    return l;
+}
+
+bool MobiDict::containsKey(const QString &key) const
+{
+    return m_dictIndex->contains(key);
+}
+
+QStringList MobiDict::findFuzzy(const QString &key, int maxDistance, int limit) const
+{
+    QStringList l;
+    for (const auto &match : m_dictIndex->findFuzzy(key, maxDistance, limit))
+        l.append(match.first);
+    return l;
 }
 
 bool MobiDict::loadDict()
@@ -152,62 +140,36 @@ bool MobiDict::buildIndex()
 
     const size_t count = m_mobiRawml->orth->total_entries_count;
 
-    std::vector<std::pair<MobiKey, MobiEntry>> entries;
     bool needSort = !sorted();
 #if defined(ENABLE_OPENCC) || defined(ENABLE_UNAC)
     needSort = true;
 #endif
-    if (needSort)
-        entries.reserve(count);
-    for (size_t i = 0; i < count; ++i) {
+    auto entries = makeEntries<MobiKey, MobiEntry>(count, needSort, [this](size_t i, MobiKey &key, MobiEntry &entry) {
         const MOBIIndexEntry *orth_entry = &m_mobiRawml->orth->entries[i];
-        QString text;
-#ifdef ENABLE_OPENCC
-        text = QString::fromStdString(QuickDict::instance()->openccConverter()->Convert(orth_entry->label));
-#else
-        text = QString::fromUtf8(orth_entry->label);
-#endif
-#ifdef ENABLE_UNAC
-        std::string utf8Text = text.toStdString();
-        char *unaccented = nullptr;
-        size_t len;
-        if (unac_string("UTF8", utf8Text.c_str(), utf8Text.size(), &unaccented, &len) != -1) {
-            text = QString::fromUtf8(unaccented, len);
-            free(unaccented);
-        }
-#endif
-        text = text.toLower();
-        MobiEntry entry;
+        key = QuickDict::instance()->normalizeKey(std::string(orth_entry->label));
         entry.first = mobi_get_orth_entry_start_offset(orth_entry);
         entry.second = mobi_get_orth_entry_text_length(orth_entry);
-        if (needSort) {
-            entries.emplace_back(text, entry);
-        } else {
-            if (!m_dictIndex->addEntry(text, entry)) {
-                qCWarning(qdDict) << "Dict:" << name() << "error: Failed to build indexes";
-                return false;
-            }
+    });
+    reportProgress(0.5);
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (!m_dictIndex->addEntry(entries[i].first, entries[i].second)) {
+            qCWarning(qdDict) << "Dict:" << name() << "error: Failed to build indexes";
+            m_dictIndex->clear();
+            return false;
         }
+        if (i % 65536 == 0)
+            reportProgress(0.5 + 0.4 * i / entries.size());
     }
+    entries = decltype(entries)();
 
-    if (needSort) {
-        std::sort(entries.begin(), entries.end(), [](const auto &lhs, const auto &rhs) {
-            return lhs.first < rhs.first;
-        });
-        for (const auto &entry : entries)
-            m_dictIndex->addEntry(entry.first, entry.second);
-        entries.clear();
-    }
-
-    m_indexFile = fopen_unicode(m_indexFileName.toStdString().c_str(), "wb+");
-    if (nullptr == m_indexFile) {
-        qCWarning(qdDict) << "Dict:" << name() << "error: Failed to open file" << m_indexFileName;
-        return false;
-    }
-    qCDebug(qdDict) << "Dict:" << name() << "status: Saving indexes...";
-    m_dictIndex->serialize(m_indexFile);
-    fclose(m_indexFile);
+    qCDebug(qdDict) << "Dict:" << name() << "status: Minimizing indexes...";
+    m_dictIndex->finish();
+    reportProgress(0.95);
+    qCInfo(qdDict) << "Dict:" << name() << "keys:" << m_dictIndex->keyCount()
+                   << "nodes:" << m_dictIndex->trieNodeCount() << "->" << m_dictIndex->nodeCount();
 
+    // without a saved index, the one in memory still serves until the next start
+    saveIndex(m_dictIndex);
     return true;
 }
 
@@ -215,13 +177,11 @@ bool MobiDict::loadIndex()
 {
     qCDebug(qdDict) << "Dict:" << name() << "status: Loading indexes...";
 
-    m_indexFile = fopen_unicode(m_indexFileName.toStdString().c_str(), "rb");
-    if (nullptr == m_indexFile) {
-        qCWarning(qdDict) << "Dict:" << name() << "error: Failed to open file" << m_indexFileName;
+    if (!m_dictIndex->map(m_indexFileName)) {
+        qCWarning(qdDict) << "Dict:" << name() << "error: Failed to map index file" << m_indexFileName;
         return false;
     }
-    m_dictIndex->deserialize(m_indexFile);
-    fclose(m_indexFile);
+    qCDebug(qdDict) << "Dict:" << name() << "keys:" << m_dictIndex->keyCount() << "bytes:" << m_dictIndex->byteCount();
 
     return true;
 }
@@ -18,6 +18,10 @@ public:
     explicit MobiDict(QObject *parent = nullptr);
     virtual ~MobiDict();
 
+    QStringList findPrefix(const QString &prefix, int limit) const override;
+    bool containsKey(const QString &key) const override;
+    QStringList findFuzzy(const QString &key, int maxDistance, int limit) const override;
+
     inline QString serialNumber() const { return m_serialNumber; }
     void setSerialNumber(const QString &serialNumber);
 
@@ -25,7 +29,8 @@ Q_SIGNALS:
     void serialNumberChanged(const QString &serialNumber);
 
 protected:
-    void onQuery(const QString &text);
+    bool lookupKey(const QString &key, qint64 ordinal, int queryId) override;
+    void forEachKey(const std::function<bool(const QString &, quint32)> &visit) const override;
     bool loadDict() override;
     bool unloadDict() override;
     bool loadOrBuildIndex();
@@ -35,7 +40,6 @@ protected:
     bool unloadIndex() override;
 
     FILE *m_dictFile = nullptr;
-    FILE *m_indexFile = nullptr;
     MOBIRawml *m_mobiRawml = nullptr;
     MobiIndex *m_dictIndex = nullptr;
     QString m_serialNumber;
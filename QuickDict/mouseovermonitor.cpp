@@ -1,11 +1,13 @@
 #include "mouseovermonitor.h"
 #include "ocrengine.h"
 #include "quickdict.h"
+#include "trace.h"
 #include <QCursor>
 #include <QGuiApplication>
 #include <QPixmap>
 #include <QScreen>
 #include <QTimer>
+#include <algorithm>
 
 MouseOverMonitor::MouseOverMonitor(QObject *parent)
     : MonitorService(parent)
@@ -33,6 +35,7 @@ bool MouseOverMonitor::doSetEnabled(bool enabled)
     } else {
         m_timer->stop();
         QuickDict::instance()->ocrEngine()->stop();
+        m_ocrCache.clear();
     }
     return true;
 }
@@ -47,8 +50,7 @@ void MouseOverMonitor::timeout()
         // mouse stops now
         m_previousCursorMoving = false;
         interval = m_idleInterval;
-        QImage screen = QGuiApplication::primaryScreen()->grabWindow(0).toImage();
-        emit QuickDict::instance()->ocrEngine()->extractText(screen, cursor);
+        extractText(cursor, m_captureSize);
     } else if (m_previousCursorMoving && cursor != m_previousCursor) {
         // mouse keeps moving
         m_previousCursorMoving = true;
@@ -67,7 +69,104 @@ void MouseOverMonitor::timeout()
     m_timer->start(interval);
 }
 
+void MouseOverMonitor::extractText(const QPoint &cursor, const QSize &size)
+{
+    QScreen *screen = QGuiApplication::screenAt(cursor);
+    if (!screen)
+        screen = QGuiApplication::primaryScreen();
+    QRect screenRect = screen->geometry();
+    QRect captureRect(QPoint(), size);
+    captureRect.moveCenter(cursor);
+    captureRect = captureRect.intersected(screenRect);
+    if (captureRect.isEmpty())
+        return;
+
+    QImage image;
+    {
+        TraceSpan span(qdMonitor(), "grabWindow");
+        // the position is relative to the screen
+        image = screen
+                    ->grabWindow(0,
+                                 captureRect.x() - screenRect.x(),
+                                 captureRect.y() - screenRect.y(),
+                                 captureRect.width(),
+                                 captureRect.height())
+                    .toImage();
+    }
+    if (image.isNull())
+        return;
+
+    m_captureCursor = cursor;
+    m_captureRect = captureRect;
+    m_screenRect = screenRect;
+    // the image is in device pixels on high DPI screens
+    m_captureScale = qreal(image.width()) / captureRect.width();
+    m_captureOrigin = (QPointF(captureRect.topLeft() - screenRect.topLeft()) * m_captureScale).toPoint();
+    QPoint p = (QPointF(cursor - captureRect.topLeft()) * m_captureScale).toPoint();
+
+    if (screen->name() != m_ocrCacheScreen) {
+        m_ocrCache.clear();
+        m_ocrCacheScreen = screen->name();
+    }
+    OcrResult cached;
+    {
+        TraceSpan span(qdMonitor(), "ocrCache");
+        m_ocrCache.update(image, m_captureOrigin);
+        if (const OcrCache::Word *word = m_ocrCache.wordAt(m_captureOrigin + p)) {
+            cached.text = word->text;
+            cached.rect = word->rect.translated(-m_captureOrigin);
+        }
+    }
+    if (!cached.text.isEmpty()) {
+        qCDebug(qdMonitor) << "Monitor:" << name() << "OCR cache hit:" << cached.text;
+        cached.id = ++m_captureId;
+        cached.rects.append(cached.rect);
+        onExtractTextResult(cached);
+        return;
+    }
+    // only the box of the word is known, Tesseract can skip the layout analysis
+    QuickDict::instance()->ocrEngine()->extractText(image, p, ++m_captureId, cached.rect);
+}
+
 void MouseOverMonitor::onExtractTextResult(const OcrResult &result)
 {
+    if (result.id != m_captureId)
+        return;
+
+    // words cut off by the edges of the capture are left out by the cache
+    if (!result.text.isEmpty())
+        m_ocrCache.insert(result.rect.translated(m_captureOrigin), result.text);
+    for (const QRect &rect : result.rects)
+        m_ocrCache.insert(rect.translated(m_captureOrigin));
+
+    // edges of the capture at the edges of the screen can't be moved any further
+    Qt::Edges edges = result.clippedEdges;
+    if (m_captureRect.left() <= m_screenRect.left())
+        edges &= ~Qt::LeftEdge;
+    if (m_captureRect.right() >= m_screenRect.right())
+        edges &= ~Qt::RightEdge;
+    if (m_captureRect.top() <= m_screenRect.top())
+        edges &= ~Qt::TopEdge;
+    if (m_captureRect.bottom() >= m_screenRect.bottom())
+        edges &= ~Qt::BottomEdge;
+    QSize size = m_captureRect.size();
+    if (edges & (Qt::LeftEdge | Qt::RightEdge))
+        size.setWidth(std::min(size.width() * 2, m_maxCaptureSize.width()));
+    if (edges & (Qt::TopEdge | Qt::BottomEdge))
+        size.setHeight(std::min(size.height() * 2, m_maxCaptureSize.height()));
+    if (size != m_captureRect.size()) {
+        qCDebug(qdMonitor) << "Monitor:" << name() << "word cut off, capture again:" << size;
+        extractText(m_captureCursor, size);
+        return;
+    }
+
+    // words as large as the capture ask for a larger one next time, small words for the initial size again
+    if (result.rect.isValid()) {
+        QSize word = result.rect.size() / m_captureScale;
+        if (word.width() * 2 > size.width() || word.height() * 2 > size.height())
+            m_captureSize = size.expandedTo(m_initialCaptureSize);
+        else if (word.width() * 4 < m_initialCaptureSize.width() && word.height() * 4 < m_initialCaptureSize.height())
+            m_captureSize = m_initialCaptureSize;
+    }
     emit query(result.text);
 }
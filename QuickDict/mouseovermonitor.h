@@ -2,7 +2,10 @@
 #define MOUSEOVERMONITOR_H
 
 #include "monitorservice.h"
+#include "ocrcache.h"
 #include <QPoint>
+#include <QRect>
+#include <QSize>
 
 struct OcrResult;
 class QTimer;
@@ -18,6 +21,14 @@ public:
     inline int idleInterval() const { return m_idleInterval; }
     void setBusyInterval(int interval) { m_busyInterval = interval; }
     inline int busyInterval() const { return m_busyInterval; }
+    /**
+     * Only a region of this size around the cursor is captured and recognized, in logical pixels. It grows up to
+     * `maxCaptureSize` while the word under the cursor is cut off by its edges.
+     */
+    void setCaptureSize(const QSize &size) { m_captureSize = m_initialCaptureSize = size; }
+    inline QSize captureSize() const { return m_initialCaptureSize; }
+    void setMaxCaptureSize(const QSize &size) { m_maxCaptureSize = size; }
+    inline QSize maxCaptureSize() const { return m_maxCaptureSize; }
 
 protected:
     bool doSetEnabled(bool enabled) override;
@@ -27,6 +38,8 @@ private Q_SLOTS:
     void onExtractTextResult(const OcrResult &result);
 
 private:
+    void extractText(const QPoint &cursor, const QSize &size);
+
     int m_idleInterval = 500;
     int m_busyInterval = 100;
     bool m_previousCursorMoving = false;
@@ -34,6 +47,22 @@ private:
     QString m_previousWord;
     QPoint m_previousCursor;
     QTimer *m_timer;
+
+    QSize m_initialCaptureSize{480, 120};
+    QSize m_maxCaptureSize{1920, 480};
+    QSize m_captureSize = m_initialCaptureSize; // adapted to the size of words lately recognized
+
+    // the last capture, results of earlier ones are dropped
+    int m_captureId = 0;
+    QPoint m_captureCursor;
+    QRect m_captureRect;      // in logical pixels of the virtual desktop
+    QRect m_screenRect;       // ditto, the screen containing the cursor
+    qreal m_captureScale = 1; // pixels of the captured image per logical pixel
+    QPoint m_captureOrigin;   // of the captured image, in device pixels relative to the screen
+
+    // words recognized earlier, reused while the screen around them stays the same
+    OcrCache m_ocrCache;
+    QString m_ocrCacheScreen;
 };
 
 #endif // MOUSEOVERMONITOR_H
@@ -0,0 +1,104 @@
+#include "ocrcache.h"
+#include <QSet>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+OcrCache::OcrCache(int tileSize, int maxWords)
+    : m_tileSize(tileSize)
+    , m_maxWords(maxWords)
+{}
+
+void OcrCache::update(const QImage &image, const QPoint &origin)
+{
+    const QImage img = image.depth() >= 8 ? image : image.convertToFormat(QImage::Format_Grayscale8);
+    const int tileBytes = m_tileSize * img.depth() / 8;
+    int left = (origin.x() + m_tileSize - 1) / m_tileSize;
+    int top = (origin.y() + m_tileSize - 1) / m_tileSize;
+    int right = (origin.x() + img.width()) / m_tileSize - 1;
+    int bottom = (origin.y() + img.height()) / m_tileSize - 1;
+    m_captureTiles = QRect(QPoint(left, top), QPoint(right, bottom));
+    if (m_captureTiles.isEmpty())
+        return;
+
+    // a row of tiles at a time, hashing their slices of every line in turn
+    QSet<quint64> changed;
+    std::vector<uint> hashes(m_captureTiles.width());
+    for (int ty = top; ty <= bottom; ++ty) {
+        std::fill(hashes.begin(), hashes.end(), 0);
+        int y0 = ty * m_tileSize - origin.y();
+        for (int y = y0; y < y0 + m_tileSize; ++y) {
+            const uchar *line = img.constScanLine(y) + (left * m_tileSize - origin.x()) * img.depth() / 8;
+            for (size_t i = 0; i < hashes.size(); ++i)
+                hashes[i] = qHashBits(line + i * tileBytes, tileBytes, hashes[i]);
+        }
+        for (int tx = left; tx <= right; ++tx) {
+            uint hash = hashes[tx - left];
+            auto it = m_tileHashes.find(tileKey(tx, ty));
+            if (it == m_tileHashes.end()) {
+                m_tileHashes.insert(tileKey(tx, ty), hash);
+            } else if (it.value() != hash) {
+                it.value() = hash;
+                changed.insert(tileKey(tx, ty));
+            }
+        }
+    }
+    if (changed.isEmpty())
+        return;
+
+    auto isChanged = [this, &changed](const Word &word) {
+        QRect tiles = tilesOf(word.rect);
+        for (int ty = tiles.top(); ty <= tiles.bottom(); ++ty) {
+            for (int tx = tiles.left(); tx <= tiles.right(); ++tx) {
+                if (changed.contains(tileKey(tx, ty)))
+                    return true;
+            }
+        }
+        return false;
+    };
+    m_words.erase(std::remove_if(m_words.begin(), m_words.end(), isChanged), m_words.end());
+}
+
+const OcrCache::Word *OcrCache::wordAt(const QPoint &p) const
+{
+    for (auto it = m_words.rbegin(); it != m_words.rend(); ++it) {
+        if (it->rect.contains(p) && m_captureTiles.contains(tilesOf(it->rect)))
+            return &*it;
+    }
+    return nullptr;
+}
+
+void OcrCache::insert(const QRect &rect, const QString &text)
+{
+    if (!rect.isValid() || !m_captureTiles.contains(tilesOf(rect)))
+        return;
+
+    auto it = std::find_if(m_words.begin(), m_words.end(), [&rect](const Word &word) { return word.rect == rect; });
+    if (it != m_words.end()) {
+        if (!text.isEmpty())
+            it->text = text;
+        return;
+    }
+    // the same pixels may be segmented differently in another capture, the latest wins
+    m_words.erase(std::remove_if(m_words.begin(),
+                                 m_words.end(),
+                                 [&rect](const Word &word) { return word.rect.intersects(rect); }),
+                  m_words.end());
+    m_words.push_back(Word{rect, text});
+    while (m_words.size() > static_cast<size_t>(m_maxWords))
+        m_words.pop_front();
+}
+
+void OcrCache::clear()
+{
+    m_tileHashes.clear();
+    m_captureTiles = QRect();
+    m_words.clear();
+}
+
+QRect OcrCache::tilesOf(const QRect &rect) const
+{
+    int border = std::ceil(rect.height() / 4.0);
+    return QRect(QPoint(std::max(rect.left() - border, 0) / m_tileSize, std::max(rect.top() - border, 0) / m_tileSize),
+                 QPoint((rect.right() + border) / m_tileSize, (rect.bottom() + border) / m_tileSize));
+}
@@ -0,0 +1,63 @@
+#ifndef OCRCACHE_H
+#define OCRCACHE_H
+
+#include <QHash>
+#include <QImage>
+#include <QPoint>
+#include <QRect>
+#include <QString>
+#include <deque>
+
+/**
+ * OcrCache remembers words recognized on a screen, so that hovering again over content which hasn't changed needs no
+ * OCR.
+ *
+ * Captures are divided into tiles aligned to a grid fixed to the screen, and the hash of every tile is kept. A
+ * capture whose tile hashes differ from the kept ones drops the words overlapping those tiles, so words are only
+ * reused while all of the pixels they were recognized from stay the same, even if the rest of the screen changes.
+ * Besides recognized words, boxes of the other words found in a capture are kept too, which spares the layout
+ * analysis of the words hovered later.
+ *
+ * Positions are in device pixels relative to the screen.
+ */
+class OcrCache
+{
+public:
+    struct Word
+    {
+        QRect rect;
+        QString text; // empty if only the box is known
+    };
+
+    explicit OcrCache(int tileSize = 32, int maxWords = 4096);
+
+    /**
+     * Hashes the tiles fully covered by @p image captured at @p origin, and drops the words on those which changed.
+     * Lookups and insertions then only consider words lying entirely within these tiles.
+     */
+    void update(const QImage &image, const QPoint &origin);
+    /**
+     * @return the word at @p p recognized from tiles of the last capture which are unchanged, @c nullptr if none.
+     */
+    const Word *wordAt(const QPoint &p) const;
+    /**
+     * Keeps the box @p rect, and its @p text if not empty, unless it reaches out of the tiles of the last capture.
+     */
+    void insert(const QRect &rect, const QString &text = QString());
+    void clear();
+
+    inline int size() const { return static_cast<int>(m_words.size()); }
+
+private:
+    /** @return range of tiles @p rect overlaps, including the border the single word pass of OcrWorker adds. */
+    QRect tilesOf(const QRect &rect) const;
+    static inline quint64 tileKey(int x, int y) { return quint64(quint32(y)) << 32 | quint32(x); }
+
+    int m_tileSize;
+    int m_maxWords;
+    QHash<quint64, uint> m_tileHashes; // by `tileKey`
+    QRect m_captureTiles;              // tiles fully covered by the last capture
+    std::deque<Word> m_words;          // oldest first
+};
+
+#endif // OCRCACHE_H
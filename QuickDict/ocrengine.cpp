@@ -3,65 +3,81 @@
 #include "quickdict.h"
 #include <tesseract/baseapi.h>
 #include <QDir>
-#include <QMutexLocker>
 #include <QThread>
+#include <algorithm>
 
 Q_LOGGING_CATEGORY(qdOcrEngine, "qd.ocr.engine")
 
 OcrEngine::OcrEngine(QObject *parent)
     : QObject(parent)
-    , m_tessApi(new tesseract::TessBaseAPI)
-    , m_ocrWorker(new OcrWorker(m_tessApi))
-{
-    m_ocrWorker->moveToThread(&m_workerThread); // OcrWorker cannot have a parent
-    connect(this, &OcrEngine::extractText, m_ocrWorker, &OcrWorker::doExtractText);
-    connect(m_ocrWorker, &OcrWorker::extractTextResult, this, &OcrEngine::extractTextResult);
-    connect(&m_workerThread, &QThread::started, this, [this]() {
-        qCInfo(qdOcrEngine) << "OcrEngine started...";
-        emit started();
-    });
-    connect(&m_workerThread, &QThread::finished, this, [this]() {
-        m_tessApi->End();
-        qCInfo(qdOcrEngine) << "OcrEngine stopped...";
-        emit stopped();
-    });
-}
+    , m_workerCount(std::max(1, std::min(QThread::idealThreadCount() / 2, 4)))
+{}
 
 OcrEngine::~OcrEngine()
 {
-    if (isRunning()) {
-        m_workerThread.quit();
-        m_workerThread.wait(200);
-        m_workerThread.terminate();
-    }
-    delete m_ocrWorker;
-    m_tessApi->End();
-    delete m_tessApi;
-    m_tessApi = nullptr;
+    stop();
 }
 
 void OcrEngine::start()
 {
-    if (!isRunning()) {
-        QString dataPath = QDir(QuickDict::dataDirPath()).filePath("tessdata");
-        QSettings *settings = QuickDict::instance()->configCenter()->settings();
-        settings->beginGroup("Tesseract");
-        QString lang = settings->value("Language", "eng").toString();
-        settings->endGroup();
-        if (m_tessApi->Init(dataPath.isNull() ? nullptr : dataPath.toStdString().c_str(), lang.toStdString().c_str())) {
-            qCCritical(qdOcrEngine) << "Could not initialize tesseract.";
-            return;
-        }
-
-        m_workerThread.start();
+    if (isRunning())
+        return;
+
+    QString dataPath = QDir(QuickDict::dataDirPath()).filePath("tessdata");
+    QSettings *settings = QuickDict::instance()->configCenter()->settings();
+    settings->beginGroup("Tesseract");
+    QString lang = settings->value("Language", "eng").toString();
+    OcrPreprocessing preprocessing;
+    preprocessing.enabled = settings->value("Preprocess", preprocessing.enabled).toBool();
+    preprocessing.detectTextRegion = settings->value("DetectTextRegion", preprocessing.detectTextRegion).toBool();
+    preprocessing.minTextHeight = settings->value("MinTextHeight", preprocessing.minTextHeight).toInt();
+    preprocessing.binarize = settings->value("Binarize", preprocessing.binarize).toBool();
+    settings->endGroup();
+
+    for (int i = 0; i < m_workerCount; ++i) {
+        std::unique_ptr<Worker> worker(new Worker);
+        worker->tessApi = new tesseract::TessBaseAPI;
+        worker->ocrWorker = new OcrWorker(worker->tessApi);
+        // loading the traineddata takes hundreds of ms, on the thread of the worker instead of the GUI thread
+        worker->ocrWorker->setLanguage(dataPath, lang);
+        worker->ocrWorker->setPreprocessing(preprocessing);
+        worker->ocrWorker->moveToThread(&worker->thread); // OcrWorker cannot have a parent
+        Worker *w = worker.get();
+        int generation = m_generation;
+        connect(w->ocrWorker, &OcrWorker::extractTextResult, this, [this, w, generation](const OcrResult &result) {
+            // results may still be queued after the workers are stopped
+            if (generation == m_generation)
+                onWorkerResult(w, result);
+        });
+        worker->thread.setObjectName(QString("OcrWorker %1").arg(i));
+        worker->thread.start();
+        m_workers.push_back(std::move(worker));
     }
+
+    qCInfo(qdOcrEngine) << "OcrEngine started..."
+                        << "workers:" << m_workers.size();
+    emit started();
 }
 
 void OcrEngine::stop()
 {
-    if (isRunning()) {
-        m_workerThread.quit();
+    if (!isRunning())
+        return;
+
+    // a running recognition can't be interrupted, wait for it
+    for (const std::unique_ptr<Worker> &worker : m_workers) {
+        worker->thread.quit();
+        worker->thread.wait();
+        delete worker->ocrWorker;
+        worker->tessApi->End();
+        delete worker->tessApi;
     }
+    m_workers.clear();
+    ++m_generation;
+    m_queue.clear();
+    emit queueDepthChanged();
+    qCInfo(qdOcrEngine) << "OcrEngine stopped...";
+    emit stopped();
 }
 
 void OcrEngine::toggle()
@@ -74,5 +90,109 @@ void OcrEngine::toggle()
 
 bool OcrEngine::isRunning() const
 {
-    return m_workerThread.isRunning();
+    return !m_workers.empty();
+}
+
+void OcrEngine::setWorkerCount(int workerCount)
+{
+    workerCount = std::max(1, workerCount);
+    if (workerCount == m_workerCount)
+        return;
+    m_workerCount = workerCount;
+    if (isRunning()) {
+        stop();
+        start();
+    }
+    emit workerCountChanged();
+}
+
+void OcrEngine::setMaxQueueDepth(int maxQueueDepth)
+{
+    // the newest request always gets in
+    maxQueueDepth = std::max(1, maxQueueDepth);
+    if (maxQueueDepth == m_maxQueueDepth)
+        return;
+    m_maxQueueDepth = maxQueueDepth;
+    emit maxQueueDepthChanged();
+}
+
+void OcrEngine::extractText(const QImage &image, const QPoint &p, int id, const QRect &wordRect)
+{
+    if (!isRunning()) {
+        qCDebug(qdOcrEngine) << "OcrEngine not running, skip request" << id;
+        return;
+    }
+    ++m_requests;
+    m_queue.push_back(Request{image, p, id, wordRect, QElapsedTimer()});
+    m_queue.back().timer.start();
+    while (m_queue.size() > static_cast<size_t>(m_maxQueueDepth)) {
+        qCDebug(qdOcrEngine) << "OcrEngine drop superseded request" << m_queue.front().id;
+        m_queue.pop_front();
+        ++m_dropped;
+    }
+    m_peakQueueDepth = std::max(m_peakQueueDepth, m_queue.size());
+    dispatch();
+    emit queueDepthChanged();
+}
+
+QVariantMap OcrEngine::stats() const
+{
+    int busy = 0;
+    for (const std::unique_ptr<Worker> &worker : m_workers)
+        busy += worker->busy;
+    return QVariantMap{{"workers", static_cast<int>(m_workers.size())},
+                       {"busyWorkers", busy},
+                       {"queueDepth", queueDepth()},
+                       {"peakQueueDepth", static_cast<int>(m_peakQueueDepth)},
+                       {"requests", m_requests},
+                       {"dropped", m_dropped},
+                       {"completed", m_completed},
+                       {"meanOcrMs", m_completed ? m_ocrTime / 1000.0 / m_completed : 0.0},
+                       {"maxOcrMs", m_maxOcrTime / 1000.0},
+                       {"lastOcrMs", m_lastOcrTime / 1000.0},
+                       {"meanWaitMs", m_completed ? m_waitTime / 1000.0 / m_completed : 0.0}};
+}
+
+void OcrEngine::dispatch()
+{
+    for (const std::unique_ptr<Worker> &worker : m_workers) {
+        if (m_queue.empty())
+            break;
+        if (worker->busy)
+            continue;
+        run(worker.get(), m_queue.front());
+        m_queue.pop_front();
+    }
+}
+
+void OcrEngine::run(Worker *worker, Request &request)
+{
+    worker->busy = true;
+    worker->timer.start();
+    m_waitTime += request.timer.nsecsElapsed() / 1000;
+    OcrWorker *ocrWorker = worker->ocrWorker;
+    QMetaObject::invokeMethod(
+        ocrWorker,
+        [ocrWorker, image = request.image, p = request.p, id = request.id, wordRect = request.wordRect]() {
+            ocrWorker->doExtractText(image, p, id, wordRect);
+        },
+        Qt::QueuedConnection);
+}
+
+void OcrEngine::onWorkerResult(Worker *worker, const OcrResult &result)
+{
+    worker->busy = false;
+    qint64 elapsed = worker->timer.nsecsElapsed() / 1000;
+    ++m_completed;
+    m_ocrTime += elapsed;
+    m_maxOcrTime = std::max(m_maxOcrTime, elapsed);
+    m_lastOcrTime = elapsed;
+    qCDebug(qdOcrEngine) << "OcrEngine request:" << result.id << "time:" << elapsed / 1000.0 << "ms"
+                         << "queue:" << m_queue.size();
+
+    emit extractTextResult(result);
+    if (!m_queue.empty()) {
+        dispatch();
+        emit queueDepthChanged();
+    }
 }
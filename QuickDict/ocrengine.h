@@ -3,9 +3,14 @@
 
 #include "ocrworker.h"
 
+#include <QElapsedTimer>
+#include <QImage>
 #include <QLoggingCategory>
-#include <QMutex>
 #include <QThread>
+#include <QVariantMap>
+#include <deque>
+#include <memory>
+#include <vector>
 
 namespace tesseract {
 class TessBaseAPI;
@@ -13,9 +18,19 @@ class TessBaseAPI;
 
 class OcrWorker;
 
+/**
+ * OcrEngine recognizes text with a pool of Tesseract instances, each on its own thread.
+ *
+ * Requests go to idle workers right away. While all of them are busy, requests wait in a queue of at most
+ * `maxQueueDepth`, and the oldest waiting request is dropped to make room for a new one, since only the latest
+ * position of the cursor matters.
+ */
 class OcrEngine : public QObject
 {
     Q_OBJECT
+    Q_PROPERTY(int workerCount READ workerCount WRITE setWorkerCount NOTIFY workerCountChanged)
+    Q_PROPERTY(int maxQueueDepth READ maxQueueDepth WRITE setMaxQueueDepth NOTIFY maxQueueDepthChanged)
+    Q_PROPERTY(int queueDepth READ queueDepth NOTIFY queueDepthChanged)
 public:
     explicit OcrEngine(QObject *parent = nullptr);
     ~OcrEngine();
@@ -25,17 +40,71 @@ public:
     Q_INVOKABLE void toggle();
     Q_INVOKABLE bool isRunning() const;
 
+    /**
+     * @return number of Tesseract instances, defaults to half of the cores, at most 4, since each of them takes
+     * tens of MB.
+     */
+    inline int workerCount() const { return m_workerCount; }
+    void setWorkerCount(int workerCount);
+    inline int maxQueueDepth() const { return m_maxQueueDepth; }
+    void setMaxQueueDepth(int maxQueueDepth);
+    inline int queueDepth() const { return static_cast<int>(m_queue.size()); }
+
+    /**
+     * Recognizes the word at @p p in @p image, the result is emitted by `extractTextResult` with @p id. @p wordRect
+     * is the box of that word if already known, see `OcrWorker::doExtractText`.
+     */
+    Q_INVOKABLE void extractText(const QImage &image, const QPoint &p, int id = 0, const QRect &wordRect = QRect());
+    /**
+     * @return numbers of requests, dropped and completed ones, queue depth and OCR time per request.
+     */
+    Q_INVOKABLE QVariantMap stats() const;
+
 Q_SIGNALS:
     void started();
     void stopped();
+    void workerCountChanged();
+    void maxQueueDepthChanged();
+    void queueDepthChanged();
 
-    void extractText(const QImage &image, const QPoint &p, int id = 0);
     void extractTextResult(const OcrResult &result);
 
 private:
-    tesseract::TessBaseAPI *m_tessApi = nullptr;
-    OcrWorker *m_ocrWorker = nullptr;
-    QThread m_workerThread;
+    struct Worker
+    {
+        tesseract::TessBaseAPI *tessApi = nullptr;
+        OcrWorker *ocrWorker = nullptr;
+        QThread thread;
+        bool busy = false;
+        QElapsedTimer timer; // since the current request was handed over
+    };
+    struct Request
+    {
+        QImage image;
+        QPoint p;
+        int id;
+        QRect wordRect;
+        QElapsedTimer timer; // since the request arrived
+    };
+
+    void dispatch();
+    void run(Worker *worker, Request &request);
+    void onWorkerResult(Worker *worker, const OcrResult &result);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::deque<Request> m_queue;
+    int m_workerCount;
+    int m_maxQueueDepth = 1;
+    int m_generation = 0; // bumped whenever the workers are stopped
+
+    quint64 m_requests = 0;
+    quint64 m_dropped = 0;
+    quint64 m_completed = 0;
+    size_t m_peakQueueDepth = 0;
+    qint64 m_ocrTime = 0; // total, in us
+    qint64 m_maxOcrTime = 0;
+    qint64 m_lastOcrTime = 0;
+    qint64 m_waitTime = 0; // total time requests waited in the queue, in us
 };
 
 Q_DECLARE_LOGGING_CATEGORY(ocrEngine)
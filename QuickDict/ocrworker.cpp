@@ -1,13 +1,141 @@
 #include "ocrworker.h"
+#include "trace.h"
 #include <cmath>
 #include <leptonica/allheaders.h>
 #include <tesseract/baseapi.h>
-#include <QBuffer>
 #include <QImage>
 #include <QRegularExpression>
+#ifdef ENABLE_OPENCV
+#include "qimagecvmat.h"
+#endif
 
 Q_LOGGING_CATEGORY(qdOcrWorker, "qd.ocr.worker")
 
+namespace {
+
+/**
+ * Maps pixels of the requested image to those of the one Tesseract got, which may be a scaled part of it.
+ */
+struct Transform
+{
+    QRect region; // of the requested image
+    qreal scale = 1;
+    QSize size; // of the image Tesseract got
+
+    QPoint toTess(const QPoint &p) const { return (QPointF(p - region.topLeft()) * scale).toPoint(); }
+    QRect toTess(const QRect &r) const
+    {
+        return QRectF(QPointF(r.topLeft() - region.topLeft()) * scale, QSizeF(r.size()) * scale).toRect();
+    }
+    QRect fromTess(const QRect &r) const
+    {
+        return QRectF(QPointF(r.topLeft()) / scale + region.topLeft(), QSizeF(r.size()) / scale).toAlignedRect();
+    }
+};
+
+#ifdef ENABLE_OPENCV
+/**
+ * @return bounding box of the line of text at @p p in @p gray, an empty one if there is none.
+ */
+cv::Rect detectTextLine(const cv::Mat &gray, const QPoint &p, qreal devicePixelRatio)
+{
+    TraceSpan span(qdOcrWorker(), "detectTextLine");
+    // edges of glyphs, whatever the colors of text and background are, smeared along lines to join glyphs up
+    cv::Mat gradient, mask;
+    cv::morphologyEx(gray, gradient, cv::MORPH_GRADIENT, cv::getStructuringElement(cv::MORPH_ELLIPSE, {3, 3}));
+    cv::threshold(gradient, mask, 0, 255, cv::THRESH_BINARY | cv::THRESH_OTSU);
+    int gap = std::max(3, qRound(9 * devicePixelRatio));
+    cv::morphologyEx(mask, mask, cv::MORPH_CLOSE, cv::getStructuringElement(cv::MORPH_RECT, {gap, 1}));
+
+    std::vector<std::vector<cv::Point>> contours;
+    cv::findContours(mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+    cv::Point point(p.x(), p.y());
+    for (const std::vector<cv::Point> &contour : contours) {
+        cv::Rect box = cv::boundingRect(contour);
+        // the box of a picture or a whole block of text is no line
+        if (box.contains(point) && box.height * 2 < gray.rows)
+            return box;
+    }
+    return cv::Rect();
+}
+
+/**
+ * Passes the band of @p image holding the line of text at @p p to @p tessApi, scaled up if the text is small and
+ * binarized, as configured by @p options. Only the grayscale copy is made of the whole image, the rest works on views
+ * of the band.
+ */
+Transform preprocess(tesseract::TessBaseAPI *tessApi,
+                     const OcrPreprocessing &options,
+                     const QImage &image,
+                     const QPoint &p,
+                     const QRect &wordRect)
+{
+    TraceSpan span(qdOcrWorker(), "preprocess");
+    cv::Mat gray;
+    switch (image.format()) {
+    case QImage::Format_Grayscale8:
+        gray = qimage2cvmat(image, false);
+        break;
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+        cv::cvtColor(qimage2cvmat(image, false), gray, cv::COLOR_BGRA2GRAY);
+        break;
+    default:
+        gray = qimage2cvmat(image.convertToFormat(QImage::Format_Grayscale8), true);
+        break;
+    }
+
+    Transform transform;
+    transform.region = image.rect();
+    cv::Rect line;
+    if (wordRect.isValid())
+        line = cv::Rect(wordRect.x(), wordRect.y(), wordRect.width(), wordRect.height());
+    else if (options.detectTextRegion)
+        line = detectTextLine(gray, p, image.devicePixelRatio());
+    line &= cv::Rect(0, 0, gray.cols, gray.rows);
+    if (!line.empty()) {
+        // the whole width, words next to the one at the point tell whether it is cut off by the edges
+        int margin = line.height / 2;
+        int top = std::max(line.y - margin, 0);
+        int bottom = std::min(line.y + line.height + margin, gray.rows);
+        transform.region = QRect(0, top, gray.cols, bottom - top);
+        if (options.minTextHeight > 0 && line.height < options.minTextHeight)
+            transform.scale = std::min(qreal(options.minTextHeight) / line.height, qreal(options.maxScale));
+    }
+
+    cv::Mat input = gray(cv::Rect(transform.region.x(),
+                                  transform.region.y(),
+                                  transform.region.width(),
+                                  transform.region.height()));
+    if (transform.scale > 1) {
+        cv::Mat scaled;
+        cv::resize(input, scaled, cv::Size(), transform.scale, transform.scale, cv::INTER_CUBIC);
+        input = scaled;
+    }
+    if (options.binarize) {
+        cv::Mat binary;
+        // Tesseract is trained on dark text on light background, light text is inverted, which needs the threshold
+        // above the local mean instead of below it to keep the background apart from the glyphs
+        bool lightOnDark = cv::mean(input)[0] < 128;
+        int type = lightOnDark ? cv::THRESH_BINARY_INV : cv::THRESH_BINARY;
+        double offset = lightOnDark ? -options.offset : options.offset;
+        int blockSize = std::max(3, options.blockSize | 1);
+        cv::adaptiveThreshold(input, binary, 255, cv::ADAPTIVE_THRESH_GAUSSIAN_C, type, blockSize, offset);
+        input = binary;
+    }
+    transform.size = QSize(input.cols, input.rows);
+
+    tessApi->SetImage(input.data, input.cols, input.rows, 1, static_cast<int>(input.step));
+    int dpi = qRound(image.dotsPerMeterX() * 0.0254 * transform.scale);
+    if (dpi > 0)
+        tessApi->SetSourceResolution(dpi);
+    return transform;
+}
+#endif
+
+} // namespace
+
 OcrWorker::OcrWorker(tesseract::TessBaseAPI *tessApi, QObject *parent)
     : QObject(parent)
     , m_tessApi(tessApi)
@@ -15,29 +143,83 @@ OcrWorker::OcrWorker(tesseract::TessBaseAPI *tessApi, QObject *parent)
 
 OcrWorker::~OcrWorker() {}
 
-void OcrWorker::doExtractText(const QImage &image, const QPoint &p, int id)
+void OcrWorker::setLanguage(const QString &dataPath, const QString &language)
+{
+    m_dataPath = dataPath;
+    m_language = language;
+    m_initPending = true;
+    m_initFailed = false;
+}
+
+bool OcrWorker::init()
+{
+    if (!m_initPending)
+        return !m_initFailed;
+    m_initPending = false;
+    TraceSpan span(qdOcrWorker(), "init");
+    if (m_tessApi->Init(m_dataPath.isNull() ? nullptr : m_dataPath.toStdString().c_str(),
+                        m_language.toStdString().c_str())) {
+        qCCritical(qdOcrWorker) << "Could not initialize tesseract.";
+        m_initFailed = true;
+    }
+    return !m_initFailed;
+}
+
+void OcrWorker::doExtractText(const QImage &image, const QPoint &p, int id, const QRect &wordRect)
 {
+    if (!init()) {
+        // an empty result still tells that the request is done
+        OcrResult result;
+        result.id = id;
+        emit extractTextResult(result);
+        return;
+    }
+    TraceSpan span(qdOcrWorker(), "extractText");
     auto psmBackup = m_tessApi->GetPageSegMode();
-    setImage(image);
-    Pixa *pixa;
-    Boxa *boxa = m_tessApi->GetWords(&pixa);
-    int count = boxaGetCount(boxa);
-    int px = p.x(), py = p.y();
+    Transform transform;
+#ifdef ENABLE_OPENCV
+    if (m_preprocessing.enabled) {
+        transform = preprocess(m_tessApi, m_preprocessing, image, p, wordRect);
+    } else
+#endif
+    {
+        setImage(m_tessApi, image);
+        transform.region = image.rect();
+        transform.size = image.size();
+    }
+
+    // boxes are in pixels of the image Tesseract got until the result is made
     QString text;
     QRect rect;
     QList<QRect> rects;
-    Box *box;
-    QRect r;
-    for (int i = 0; i < count; ++i) {
-        box = boxaGetBox(boxa, i, L_CLONE);
-        rects.append(QRect(box->x, box->y, box->w, box->h));
-        if (!rect.isValid() && box->x <= px && box->y <= py && box->x + box->w > px && box->y + box->h > py) {
-            r = QRect(box->x, box->y, box->w, box->h);
-            if (r != image.rect()) {
-                rect = r;
+    if (wordRect.isValid()) {
+        rect = transform.toTess(wordRect);
+        rects.append(rect);
+    } else {
+        Pixa *pixa;
+        Boxa *boxa;
+        {
+            TraceSpan wordsSpan(qdOcrWorker(), "GetWords");
+            boxa = m_tessApi->GetWords(&pixa);
+        }
+        int count = boxaGetCount(boxa);
+        QPoint tp = transform.toTess(p);
+        int px = tp.x(), py = tp.y();
+        Box *box;
+        QRect r;
+        for (int i = 0; i < count; ++i) {
+            box = boxaGetBox(boxa, i, L_CLONE);
+            rects.append(QRect(box->x, box->y, box->w, box->h));
+            if (!rect.isValid() && box->x <= px && box->y <= py && box->x + box->w > px && box->y + box->h > py) {
+                r = QRect(box->x, box->y, box->w, box->h);
+                if (r != QRect(QPoint(), transform.size)) {
+                    rect = r;
+                }
             }
+            boxDestroy(&box);
         }
-        boxDestroy(&box);
+        pixaDestroy(&pixa);
+        boxaDestroy(&boxa);
     }
 
     if (rect.isValid()) {
@@ -45,39 +227,61 @@ void OcrWorker::doExtractText(const QImage &image, const QPoint &p, int id)
         int border = std::ceil((float) rect.height() / 4.0);
         int x = std::max(rect.x() - border, 0);
         int y = std::max(rect.y() - border, 0);
-        int w = std::min(rect.width() + 2 * border, image.width());
-        int h = std::min(rect.height() + 2 * border, image.height());
+        int w = std::min(rect.width() + 2 * border, transform.size.width());
+        int h = std::min(rect.height() + 2 * border, transform.size.height());
         m_tessApi->SetRectangle(x, y, w, h);
 
-        char *result = m_tessApi->GetUTF8Text();
+        char *result;
+        {
+            TraceSpan textSpan(qdOcrWorker(), "GetUTF8Text");
+            result = m_tessApi->GetUTF8Text();
+        }
         text = QString::fromUtf8(result);
         static QRegularExpression whitesapces("[ \t\n]");
         text.remove(whitesapces);
-        int index = std::round((p.x() - rect.left()) * (text.size() - 1) * 1.0 / (rect.right() - rect.left()));
+        QPoint tp = transform.toTess(p);
+        int index = std::round((tp.x() - rect.left()) * (text.size() - 1) * 1.0 / (rect.right() - rect.left()));
         qCDebug(qdOcrWorker) << "text: " << text << " index: " << index << "char: " << QString(text[index]);
         delete[] result;
     }
 
-    pixaDestroy(&pixa);
-    boxaDestroy(&boxa);
     m_tessApi->Clear();
     m_tessApi->SetPageSegMode(psmBackup);
 
+    Qt::Edges clippedEdges;
+    if (rect.isValid()) {
+        rect = transform.fromTess(rect);
+        if (rect.left() <= 0)
+            clippedEdges |= Qt::LeftEdge;
+        if (rect.top() <= 0)
+            clippedEdges |= Qt::TopEdge;
+        if (rect.right() >= image.width() - 1)
+            clippedEdges |= Qt::RightEdge;
+        if (rect.bottom() >= image.height() - 1)
+            clippedEdges |= Qt::BottomEdge;
+    }
+    for (QRect &r : rects)
+        r = transform.fromTess(r);
+
     OcrResult result;
+    result.id = id;
     result.text = text;
     result.rect = rect;
     result.rects = rects;
+    result.clippedEdges = clippedEdges;
     emit extractTextResult(result);
 }
 
-void OcrWorker::setImage(const QImage &image)
+void OcrWorker::setImage(tesseract::TessBaseAPI *tessApi, const QImage &image)
 {
-    QByteArray bytes;
-    QBuffer buf(&bytes);
-    buf.open(QIODevice::WriteOnly);
-    image.save(&buf, "PNG");
-
-    Pix *img = pixReadMemPng((l_uint8 *) bytes.constData(), bytes.size());
-    m_tessApi->SetImage(img);
-    pixDestroy(&img);
+    TraceSpan span(qdOcrWorker(), "setImage");
+    // Tesseract reads 32-bit pixels in RGBA byte order, while screenshots are BGRA on little endian machines.
+    // Grayscale is what Tesseract thresholds anyway, and a quarter of the size to copy.
+    const QImage gray = image.format() == QImage::Format_Grayscale8 ? image
+                                                                     : image.convertToFormat(QImage::Format_Grayscale8);
+    tessApi->SetImage(gray.constBits(), gray.width(), gray.height(), 1, gray.bytesPerLine());
+    // same as the PNG encoding used to tell, otherwise Tesseract guesses 70 dpi
+    int dpi = qRound(image.dotsPerMeterX() * 0.0254);
+    if (dpi > 0)
+        tessApi->SetSourceResolution(dpi);
 }
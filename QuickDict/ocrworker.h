@@ -11,9 +11,25 @@ class TessBaseAPI;
 
 struct OcrResult
 {
+    int id = 0; // id of the request
     QString text;
-    QRect rect;
-    QList<QRect> rects;
+    QRect rect;             // box of the word under the point, in pixels of the image
+    QList<QRect> rects;     // boxes of all words
+    Qt::Edges clippedEdges; // edges of the image the word touches, i.e. it may be cut off there
+};
+
+/**
+ * Cleanups of screenshots before they go to Tesseract, done with OpenCV if enabled.
+ */
+struct OcrPreprocessing
+{
+    bool enabled = true;
+    bool detectTextRegion = true; // only recognize the line of text at the point
+    int minTextHeight = 32;       // lines lower than this, in pixels, are scaled up, 0 disables scaling
+    double maxScale = 4;
+    bool binarize = true; // adaptive thresholding, against low contrast and colored backgrounds
+    int blockSize = 31;   // of the neighborhood a threshold is computed from, in pixels, odd
+    double offset = 10;   // distance of the threshold from the mean of the neighborhood, toward the background
 };
 
 class OcrWorker : public QObject
@@ -23,16 +39,46 @@ public:
     explicit OcrWorker(tesseract::TessBaseAPI *tessApi, QObject *parent = nullptr);
     ~OcrWorker();
 
+    /**
+     * Passes the pixels of @p image to @p tessApi without encoding them, converted to 8-bit grayscale unless they
+     * already are. Tesseract copies them, so @p image may be released afterwards.
+     */
+    static void setImage(tesseract::TessBaseAPI *tessApi, const QImage &image);
+
+    /**
+     * Takes effect from the next request on, so set it before moving the worker to its thread.
+     */
+    void setPreprocessing(const OcrPreprocessing &preprocessing) { m_preprocessing = preprocessing; }
+    inline const OcrPreprocessing &preprocessing() const { return m_preprocessing; }
+    /**
+     * Initializes the Tesseract API with @p language from @p dataPath on the thread of the worker when it takes its
+     * first request, since that takes hundreds of ms. Without it, the API must have been initialized already. Set it
+     * before moving the worker to its thread.
+     */
+    void setLanguage(const QString &dataPath, const QString &language);
+
 public Q_SLOTS:
-    void doExtractText(const QImage &image, const QPoint &p, int id = 0);
+    /**
+     * Recognizes the word at @p p in @p image. The layout analysis finding the boxes of words is skipped if
+     * @p wordRect, the box of the word at @p p, is already known.
+     */
+    void doExtractText(const QImage &image, const QPoint &p, int id = 0, const QRect &wordRect = QRect());
 
 Q_SIGNALS:
     void extractTextResult(const OcrResult &result);
 
 private:
-    void setImage(const QImage &image);
+    /**
+     * @return @c true if the Tesseract API is initialized, initializing it first if needed.
+     */
+    bool init();
 
     tesseract::TessBaseAPI *m_tessApi;
+    OcrPreprocessing m_preprocessing;
+    QString m_dataPath;
+    QString m_language;
+    bool m_initPending = false;
+    bool m_initFailed = false;
 };
 
 Q_DECLARE_LOGGING_CATEGORY(ocrWorker)
@@ -34,6 +34,7 @@ cv::Mat qimage2cvmat(const QImage &src, bool enableDeepCopy)
     switch (src.format()) {
     // Gray image
     case QImage::Format_Indexed8:
+    case QImage::Format_Grayscale8:
         dst = cv::Mat(src.height(),
                       src.width(),
                       CV_8UC1,
@@ -199,7 +199,8 @@ Page {
                     model: qd.dicts.sort((first, second) => first.name.localeCompare(second.name))
                     delegate: CheckBox {
                         checked: modelData.enabled
-                        text: modelData.name
+                        // only local dictionaries load in the background
+                        text: modelData.loading ? qsTr("%1 (loading %2%)").arg(modelData.name).arg(Math.round(modelData.progress * 100)) : modelData.name
                         font.pixelSize: sp(14)
                         ToolTip.visible: hovered && modelData.description
                         ToolTip.text: modelData.description
@@ -53,9 +53,62 @@ ApplicationWindow {
                 }
             }
 
+            Keys.onUpPressed: {
+                if (completionPopup.opened)
+                    completionList.decrementCurrentIndex()
+            }
+            Keys.onDownPressed: {
+                if (completionPopup.opened)
+                    completionList.incrementCurrentIndex()
+            }
+            Keys.onEscapePressed: completionPopup.close()
+
+            onTextEdited: {
+                completionList.model = text.trim() ? qd.completions(text, 8) : []
+                completionList.currentIndex = -1
+                if (completionList.count > 0)
+                    completionPopup.open()
+                else
+                    completionPopup.close()
+            }
+
             onAccepted: {
+                if (completionPopup.opened && completionList.currentIndex >= 0)
+                    text = completionList.model[completionList.currentIndex]
+                completionPopup.close()
                 textFieldMonitor.query(text)
             }
+
+            Popup {
+                id: completionPopup
+                y: textField.height
+                width: textField.width
+                height: Math.min(completionList.contentHeight + topPadding + bottomPadding, dp(240))
+                padding: dp(2)
+                focus: false
+                closePolicy: Popup.CloseOnPressOutsideParent
+
+                ListView {
+                    id: completionList
+                    anchors.fill: parent
+                    clip: true
+                    currentIndex: -1
+
+                    delegate: ItemDelegate {
+                        width: completionList.width
+                        text: modelData
+                        font.pixelSize: sp(16)
+                        highlighted: ListView.isCurrentItem
+                        focusPolicy: Qt.NoFocus
+
+                        onClicked: {
+                            textField.text = modelData
+                            completionPopup.close()
+                            textFieldMonitor.query(modelData)
+                        }
+                    }
+                }
+            }
         }
         Label {
             text: stackView.currentItem.title
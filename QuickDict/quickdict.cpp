@@ -1,9 +1,13 @@
 #include "quickdict.h"
 #include "configcenter.h"
 #include "dictservice.h"
+#include "localdict.h"
 #include "monitorservice.h"
+#include "trace.h"
+#include "unifiedindex.h"
 #include <QCoreApplication>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QFontMetrics>
 #include <QGuiApplication>
@@ -14,6 +18,9 @@
 #ifdef ENABLE_OPENCC
 #include <opencc/Exception.hpp>
 #endif
+#ifdef ENABLE_UNAC
+#include <unac/unac.h>
+#endif
 
 Q_LOGGING_CATEGORY(qd, "qd.default")
 
@@ -23,6 +30,13 @@ QuickDict::QuickDict(QObject *parent)
     : QObject(parent)
 {
     m_pixelScale = qApp->primaryScreen()->logicalDotsPerInch() / 96.0;
+    m_resultCache.setMaxCost(32 * 1024 * 1024);
+    m_unifiedIndexTimer.setSingleShot(true);
+    m_unifiedIndexTimer.setInterval(1000);
+    connect(&m_unifiedIndexTimer, &QTimer::timeout, this, &QuickDict::rebuildUnifiedIndex);
+    m_unifiedIndexPool.setMaxThreadCount(1);
+    // connected first, so that the id of a query is known to all other receivers of `query`
+    connect(this, &QuickDict::query, this, &QuickDict::onQuery);
 #ifdef ENABLE_OPENCC
     QDir openccDir(dataDirPath());
     openccDir.cd("opencc");
@@ -49,6 +63,7 @@ QuickDict::QuickDict(QObject *parent)
 
 QuickDict::~QuickDict()
 {
+    m_unifiedIndexPool.waitForDone();
 #ifdef ENABLE_HUNSPELL
     delete m_hunspell;
 #endif
@@ -178,6 +193,15 @@ QString QuickDict::logDirPath()
         qCWarning(qd) << "Cannot make dir:" << dir.absoluteFilePath(qApp->applicationName());
     return dir.filePath(qApp->applicationName());
 }
+
+QString QuickDict::cacheDirPath()
+{
+    QString path = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if (!QDir().mkpath(path))
+        qCWarning(qd) << "Cannot make dir:" << path;
+    return path;
+}
+
 void QuickDict::registerMonitor(MonitorService *monitor)
 {
     qCInfo(qdMonitor) << "Register monitor:" << monitor->name();
@@ -191,6 +215,18 @@ void QuickDict::registerDict(DictService *dict)
 {
     qCInfo(qdDict) << "Register dict:" << dict->name();
     m_dicts.push_back(dict);
+    if (LocalDict *localDict = qobject_cast<LocalDict *>(dict)) {
+        connect(localDict, &LocalDict::sourceChanged, this, qOverload<>(&QuickDict::invalidateResults));
+        connect(localDict, &LocalDict::loadedChanged, this, qOverload<>(&QuickDict::invalidateResults));
+        connect(localDict, &LocalDict::queryFinished, this, &QuickDict::onDictQueryFinished);
+        connect(localDict, &LocalDict::loadedChanged, this, [this, localDict]() {
+            ++m_unifiedVersions[localDict];
+            scheduleUnifiedIndex();
+        });
+        m_unifiedSlots.insert(localDict, m_nextUnifiedSlot++);
+        m_unifiedVersions.insert(localDict, 0);
+        scheduleUnifiedIndex();
+    }
     handleDict(dict, dict->enabled());
     connect(dict, &DictService::enabledChanged, this, &QuickDict::onDictEnabledChanged);
     emit dictsChanged();
@@ -262,6 +298,106 @@ QRect QuickDict::textBoundingRect(const QFont &font, const QString &text) const
     return fm.boundingRect(text);
 }
 
+QStringList QuickDict::completions(const QString &text, int limit) const
+{
+    QStringList l;
+    QString prefix = normalizeKey(text.trimmed());
+    if (prefix.isEmpty() || limit <= 0)
+        return l;
+    for (DictService *dict : m_dicts) {
+        LocalDict *localDict = qobject_cast<LocalDict *>(dict);
+        if (localDict && localDict->enabled() && localDict->loaded())
+            l << localDict->findPrefix(prefix, limit);
+    }
+    l.sort();
+    l.removeDuplicates();
+    if (l.size() > limit)
+        l.erase(l.begin() + limit, l.end());
+    return l;
+}
+
+QString QuickDict::normalizeKey(const std::string &text) const
+{
+    return unaccentKey(convertKey(text));
+}
+
+QStringList QuickDict::queryKeys(const QString &text)
+{
+    if (text == m_queryText)
+        return m_queryKeys;
+
+    QVariantMap timings;
+    QElapsedTimer timer;
+    timer.start();
+    qint64 total = 0;
+    auto lap = [&](const char *step) {
+        qint64 elapsed = timer.nsecsElapsed();
+        timer.restart();
+        total += elapsed;
+        timings[step] = elapsed / 1000.0;
+    };
+
+    TraceSpan span(qd(), "queryKeys", text);
+    QStringList keys;
+    QString trimmed = text.trimmed();
+    std::string utf8Text = trimmed.toStdString();
+    lap("trim");
+    if (!trimmed.isEmpty()) {
+        std::string converted;
+        {
+            TraceSpan openccSpan(qd(), "opencc");
+            converted = convertKey(utf8Text);
+        }
+        lap("opencc");
+        {
+            TraceSpan unacSpan(qd(), "unac");
+            keys << unaccentKey(converted);
+        }
+        lap("unac");
+#ifdef ENABLE_HUNSPELL
+        TraceSpan hunspellSpan(qd(), "hunspell");
+        // e.g. "went" -> "go", so that inflected forms are found by their headwords
+        for (const std::string &stem : m_hunspell->stem(trimmed.toLower().toStdString())) {
+            QString key = normalizeKey(stem);
+            if (!keys.contains(key))
+                keys << key;
+        }
+        lap("hunspell");
+#endif
+    }
+    timings["total"] = total / 1000.0;
+
+    m_queryText = text;
+    m_queryKeys = keys;
+    m_queryTimings = timings;
+    qCDebug(qd) << "Query:" << text << "keys:" << keys << "timings:" << timings;
+    emit queryTimingsChanged();
+    return keys;
+}
+
+std::string QuickDict::convertKey(const std::string &text) const
+{
+#ifdef ENABLE_OPENCC
+    if (m_openccConverter)
+        return m_openccConverter->Convert(text);
+#endif
+    return text;
+}
+
+QString QuickDict::unaccentKey(const std::string &text) const
+{
+#ifdef ENABLE_UNAC
+    char *unaccented = nullptr;
+    size_t len;
+    if (unac_string("UTF8", text.c_str(), text.size(), &unaccented, &len) != -1) {
+        QString key = QString::fromUtf8(unaccented, len).toLower();
+        free(unaccented);
+        return key;
+    }
+#endif
+    return QString::fromStdString(text).toLower();
+}
+
 void QuickDict::onMonitorEnabledChanged(bool enabled)
 {
     MonitorService *monitor = qobject_cast<MonitorService *>(sender());
@@ -288,17 +424,250 @@ void QuickDict::handleDict(DictService *dict, bool enabled)
 {
     qCInfo(qdDict) << "Dict:" << dict->name() << "enabled:" << enabled;
     if (enabled) {
-        connect(this, &QuickDict::query, dict, &DictService::query);
-        connect(dict, &DictService::queryResult, this, &QuickDict::queryResult);
+        connect(dict, &DictService::queryResult, this, &QuickDict::onDictQueryResult, Qt::UniqueConnection);
     } else {
-        disconnect(this, &QuickDict::query, dict, &DictService::query);
-        disconnect(dict, &DictService::queryResult, this, &QuickDict::queryResult);
+        disconnect(dict, &DictService::queryResult, this, &QuickDict::onDictQueryResult);
+        invalidateResults(dict);
+    }
+    if (qobject_cast<LocalDict *>(dict))
+        scheduleUnifiedIndex();
+}
+
+void QuickDict::setResultCacheSize(int resultCacheSize)
+{
+    if (resultCacheSize == m_resultCache.maxCost())
+        return;
+    m_resultCache.setMaxCost(resultCacheSize);
+    emit resultCacheSizeChanged();
+}
+
+QVariantMap QuickDict::resultCacheStats() const
+{
+    quint64 lookups = m_resultCacheHits + m_resultCacheMisses;
+    return QVariantMap{{"hits", m_resultCacheHits},
+                       {"misses", m_resultCacheMisses},
+                       {"hitRate", lookups ? qreal(m_resultCacheHits) / lookups : 0.0},
+                       {"entries", m_resultCache.count()},
+                       {"bytes", m_resultCache.totalCost()}};
+}
+
+void QuickDict::setUnifiedIndex(bool unifiedIndex)
+{
+    if (unifiedIndex == m_unifiedIndexEnabled)
+        return;
+    m_unifiedIndexEnabled = unifiedIndex;
+    if (unifiedIndex)
+        scheduleUnifiedIndex();
+    else
+        m_unifiedIndex.reset();
+    emit unifiedIndexChanged();
+}
+
+void QuickDict::releaseDict(LocalDict *dict)
+{
+    // the rebuild running may be reading `dict`
+    m_unifiedIndexPool.waitForDone();
+    m_unifiedSlots.remove(dict);
+    m_unifiedVersions.remove(dict);
+    // NOTE: `dictsChanged` is not emitted, since dicts are only destroyed along with the QML engine
+    m_dicts.removeAll(dict);
+    invalidateResults(dict);
+}
+
+void QuickDict::scheduleUnifiedIndex()
+{
+    if (m_unifiedIndexEnabled)
+        m_unifiedIndexTimer.start();
+}
+
+void QuickDict::rebuildUnifiedIndex()
+{
+    if (!m_unifiedIndexEnabled)
+        return;
+    if (m_unifiedIndexBuilding) {
+        m_unifiedIndexPending = true;
+        return;
+    }
+
+    QVector<UnifiedIndex::Source> sources;
+    for (auto it = m_unifiedSlots.cbegin(); it != m_unifiedSlots.cend(); ++it) {
+        LocalDict *dict = it.key();
+        if (dict->enabled() && dict->loaded()) {
+            auto enumerateKeys = [dict](const std::function<bool(const QString &, quint32)> &visit) {
+                return dict->enumerateKeys(visit);
+            };
+            sources.append(UnifiedIndex::Source{it.value(), m_unifiedVersions.value(dict), enumerateKeys});
+        }
+    }
+    if (sources.isEmpty()) {
+        m_unifiedIndex.reset();
+        return;
+    }
+
+    m_unifiedIndexBuilding = true;
+    std::shared_ptr<const UnifiedIndex> base = m_unifiedIndex;
+    m_unifiedIndexPool.start([this, base, sources]() {
+        std::shared_ptr<const UnifiedIndex> index = UnifiedIndex::build(base, sources);
+        QMetaObject::invokeMethod(
+            this,
+            [this, index]() {
+                m_unifiedIndexBuilding = false;
+                if (m_unifiedIndexEnabled)
+                    m_unifiedIndex = index;
+                if (m_unifiedIndexPending) {
+                    m_unifiedIndexPending = false;
+                    rebuildUnifiedIndex();
+                }
+            },
+            Qt::QueuedConnection);
+    });
+}
+
+bool QuickDict::tracing() const
+{
+    return Trace::isEnabled();
+}
+
+void QuickDict::setTracing(bool tracing)
+{
+    if (tracing == Trace::isEnabled())
+        return;
+    if (tracing)
+        Trace::clear();
+    Trace::setEnabled(tracing);
+    qCInfo(qd) << "Trace: enabled:" << tracing;
+    if (!tracing)
+        saveTrace();
+    emit tracingChanged();
+}
+
+QString QuickDict::saveTrace() const
+{
+    QString fileName = QDir(logDirPath()).filePath("trace.json");
+    int count = Trace::save(fileName);
+    if (count < 0) {
+        qCWarning(qd) << "Trace: cannot write file:" << fileName;
+        return QString();
+    }
+    qCInfo(qd) << "Trace: saved" << count << "events to" << fileName;
+    return fileName;
+}
+
+void QuickDict::onQuery(const QString &text)
+{
+    Trace::instant(qd(), "query", text);
+    int queryId = ++m_queryId;
+    emit queryIdChanged();
+    // queued, so that receivers of `query` (e.g. the result view) are done before cached results arrive
+    QMetaObject::invokeMethod(
+        this, [this, text, queryId]() { dispatchQuery(text, queryId); }, Qt::QueuedConnection);
+}
+
+void QuickDict::dispatchQuery(const QString &text, int queryId)
+{
+    if (queryId != this->queryId()) {
+        qCDebug(qd) << "Query:" << text << "superseded, skip";
+        return;
+    }
+
+    TraceSpan span(qd(), "dispatchQuery", text);
+    const QStringList keys = queryKeys(text);
+    m_collectingKeys = keys;
+    m_collectedResults.clear();
+    // resolved on the first cache miss, once for all dicts in the unified index
+    std::shared_ptr<const UnifiedIndex> unified = m_unifiedIndexEnabled ? m_unifiedIndex : nullptr;
+    QHash<uint32_t, QList<LocalDictHit>> unifiedHits;
+    bool unifiedResolved = false;
+    for (DictService *dict : qAsConst(m_dicts)) {
+        if (!dict->enabled())
+            continue;
+        LocalDict *localDict = qobject_cast<LocalDict *>(dict);
+        // only loaded local dicts tell when all results of a query have arrived
+        if (!localDict || !localDict->loaded() || keys.isEmpty()) {
+            emit dict->query(text, queryId);
+            continue;
+        }
+
+        ResultKey key(keys, dict);
+        if (const QList<QJsonObject> *results = m_resultCache.object(key)) {
+            ++m_resultCacheHits;
+            for (QJsonObject result : *results) {
+                result["id"] = queryId;
+                emit queryResult(result);
+            }
+            continue;
+        }
+        ++m_resultCacheMisses;
+
+        // results arrive from the lookup thread of the dict, and are collected until it finishes
+        m_collectedResults.insert(dict, QList<QJsonObject>());
+        auto slot = m_unifiedSlots.constFind(localDict);
+        // a dict loaded again since the unified index was built is looked up on its own until the rebuild
+        if (unified && slot != m_unifiedSlots.cend() && unified->version(*slot) == m_unifiedVersions.value(localDict)) {
+            if (!unifiedResolved) {
+                QElapsedTimer timer;
+                timer.start();
+                TraceSpan unifiedSpan(qd(), "unifiedIndex");
+                unifiedHits = unified->lookup(keys);
+                unifiedResolved = true;
+                qCDebug(qd) << "Query:" << text << "unified index hits:" << unifiedHits.size()
+                            << "time:" << timer.nsecsElapsed() / 1000.0 << "us";
+            }
+            localDict->queryHits(unifiedHits.value(*slot), queryId);
+            continue;
+        }
+        emit dict->query(text, queryId);
+    }
+}
+
+void QuickDict::onDictQueryResult(const QJsonObject &result)
+{
+    // results without id come from dicts unaware of ids, pass them on
+    if (result.contains("id") && result.value("id").toInt() != queryId()) {
+        qCDebug(qdDict) << "Dict:" << qobject_cast<DictService *>(sender())->name() << "drop stale result"
+                        << result.value("text").toString();
+        return;
+    }
+    auto it = m_collectedResults.find(qobject_cast<DictService *>(sender()));
+    if (it != m_collectedResults.end())
+        it->append(result);
+    Trace::instant(qdDict(), "queryResult", result.value("engine").toString());
+    emit queryResult(result);
+}
+
+void QuickDict::onDictQueryFinished(int queryId)
+{
+    DictService *dict = qobject_cast<DictService *>(sender());
+    if (queryId != this->queryId() || !m_collectedResults.contains(dict))
+        return;
+    QList<QJsonObject> *results = new QList<QJsonObject>(m_collectedResults.take(dict));
+    int cost = 64;
+    for (const QJsonObject &result : qAsConst(*results))
+        cost += 64 + 2 * (result.value("result").toString().size() + result.value("text").toString().size());
+    m_resultCache.insert(ResultKey(m_collectingKeys, dict), results, cost);
+}
+
+void QuickDict::invalidateResults()
+{
+    invalidateResults(qobject_cast<DictService *>(sender()));
+}
+
+void QuickDict::invalidateResults(DictService *dict)
+{
+    m_collectedResults.remove(dict);
+    const QList<ResultKey> keys = m_resultCache.keys();
+    for (const ResultKey &key : keys) {
+        if (key.second == dict)
+            m_resultCache.remove(key);
     }
 }
 
 void QuickDict::onConfigChanged(const QString &key, const QVariant &value)
 {
     if (key == QStringLiteral("/lang/sl")) {
+        // queries are stemmed for the source language
+        m_queryText.clear();
+        m_resultCache.clear();
         emit sourceLanguageChanged(value.toString());
     } else if (key == QStringLiteral("/lang/tl")) {
         emit targetLanguageChanged(value.toString());
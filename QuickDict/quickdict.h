@@ -2,6 +2,9 @@
 #define QUICKDICT_H
 
 #include "service.h"
+#include <QAtomicInt>
+#include <QCache>
+#include <QHash>
 #ifdef ENABLE_OPENCC
 #include <opencc/opencc.h>
 #endif
@@ -12,6 +15,10 @@
 #include <QLoggingCategory>
 #include <QObject>
 #include <QRect>
+#include <QThreadPool>
+#include <QTimer>
+#include <QVariantMap>
+#include <memory>
 
 #ifdef ENABLE_TESSERACT
 class OcrEngine;
@@ -19,6 +26,8 @@ class OcrEngine;
 class ConfigCenter;
 class MonitorService;
 class DictService;
+class LocalDict;
+class UnifiedIndex;
 
 class QuickDict : public QObject
 {
@@ -42,6 +51,13 @@ class QuickDict : public QObject
     Q_PROPERTY(QString configDirPath READ configDirPath CONSTANT);
     Q_PROPERTY(QString dataDirPath READ dataDirPath CONSTANT);
     Q_PROPERTY(QString logDirPath READ logDirPath CONSTANT);
+    Q_PROPERTY(QString cacheDirPath READ cacheDirPath CONSTANT);
+
+    Q_PROPERTY(int queryId READ queryId NOTIFY queryIdChanged);
+    Q_PROPERTY(QVariantMap queryTimings READ queryTimings NOTIFY queryTimingsChanged);
+    Q_PROPERTY(int resultCacheSize READ resultCacheSize WRITE setResultCacheSize NOTIFY resultCacheSizeChanged);
+    Q_PROPERTY(bool unifiedIndex READ unifiedIndex WRITE setUnifiedIndex NOTIFY unifiedIndexChanged);
+    Q_PROPERTY(bool tracing READ tracing WRITE setTracing NOTIFY tracingChanged);
 
 public:
     explicit QuickDict(QObject *parent = nullptr);
@@ -85,6 +101,7 @@ public:
     static QString configDirPath();
     static QString dataDirPath();
     static QString logDirPath();
+    static QString cacheDirPath();
 
     Q_INVOKABLE void registerMonitor(MonitorService *monitor);
     QList<QObject *> monitors() const;
@@ -95,6 +112,69 @@ public:
     Q_INVOKABLE QStringList availableLocales() const;
     Q_INVOKABLE QObject *findChild(const QString &name, QObject *parent = nullptr) const;
     Q_INVOKABLE QRect textBoundingRect(const QFont &font, const QString &text) const;
+    /**
+     * @return at most @p limit headwords starting with @p text from enabled local dicts in ascending order.
+     */
+    Q_INVOKABLE QStringList completions(const QString &text, int limit = 10) const;
+
+    /**
+     * Normalizes @p text the same way headwords are indexed: converted by OpenCC, unaccented and lowercased.
+     * Safe to call from index building threads.
+     */
+    QString normalizeKey(const std::string &text) const;
+    QString normalizeKey(const QString &text) const { return normalizeKey(text.toStdString()); }
+    /**
+     * Normalizes a query once for all dictionaries, the result is reused while @p text stays the same.
+     * @return normalized key of @p text followed by normalized stems of it found by Hunspell, empty if @p text is
+     * blank.
+     */
+    QStringList queryKeys(const QString &text);
+    /**
+     * @return id of the current query, increased by every `query`. Only results with this id are passed on.
+     */
+    int queryId() const { return m_queryId.loadRelaxed(); }
+    Q_SIGNAL void queryIdChanged();
+    /**
+     * @return time spent in each step of the last query normalization in microseconds: "trim", "opencc", "unac",
+     * "hunspell" and "total".
+     */
+    QVariantMap queryTimings() const { return m_queryTimings; }
+    Q_SIGNAL void queryTimingsChanged();
+
+    /**
+     * @return maximum bytes of results of local dicts kept in memory.
+     */
+    int resultCacheSize() const { return m_resultCache.maxCost(); }
+    void setResultCacheSize(int resultCacheSize);
+    Q_SIGNAL void resultCacheSizeChanged();
+    /**
+     * @return hits, misses, hit rate and current usage of the result cache.
+     */
+    Q_INVOKABLE QVariantMap resultCacheStats() const;
+
+    /**
+     * @return @c true if enabled local dicts are looked up with a single index merged from all of them, which is
+     * rebuilt in the background whenever one of them is loaded, unloaded, enabled or disabled.
+     */
+    bool unifiedIndex() const { return m_unifiedIndexEnabled; }
+    void setUnifiedIndex(bool unifiedIndex);
+    Q_SIGNAL void unifiedIndexChanged();
+    /**
+     * Forgets @p dict, waiting for index rebuilds reading it. Called by local dicts being destroyed.
+     */
+    void releaseDict(LocalDict *dict);
+
+    /**
+     * @return @c true while the stages of queries are traced, see `Trace`. The trace is saved when it stops.
+     */
+    bool tracing() const;
+    void setTracing(bool tracing);
+    Q_SIGNAL void tracingChanged();
+    /**
+     * Saves the trace recorded so far to "trace.json" in the log dir.
+     * @return path of the trace file, empty if it can't be written.
+     */
+    Q_INVOKABLE QString saveTrace() const;
 
 #ifdef ENABLE_OPENCC
     opencc::SimpleConverter const *openccConverter() const { return m_openccConverter; }
@@ -113,10 +193,20 @@ private Q_SLOTS:
     void onMonitorEnabledChanged(bool enabled);
     void onDictEnabledChanged(bool enabled);
     void onConfigChanged(const QString &key, const QVariant &value);
+    void onDictQueryResult(const QJsonObject &result);
+    void onDictQueryFinished(int queryId);
+    void onQuery(const QString &text);
+    void invalidateResults();
+    void rebuildUnifiedIndex();
 
 private:
     void handleMonitor(MonitorService *monitor, bool enabled);
     void handleDict(DictService *dict, bool enabled);
+    void invalidateResults(DictService *dict);
+    void scheduleUnifiedIndex();
+    void dispatchQuery(const QString &text, int queryId);
+    std::string convertKey(const std::string &text) const;
+    QString unaccentKey(const std::string &text) const;
 
     static QuickDict *_instance;
 #ifdef ENABLE_TESSERACT
@@ -130,12 +220,35 @@ private:
     QList<DictService *> m_dicts;
 
 #ifdef ENABLE_OPENCC
-    opencc::SimpleConverter *m_openccConverter;
+    opencc::SimpleConverter *m_openccConverter = nullptr;
 #endif
 #ifdef ENABLE_HUNSPELL
     Hunspell *m_hunspell = nullptr;
 #endif
 
+    QAtomicInt m_queryId = 0; // read by lookup threads
+    QString m_queryText;
+    QStringList m_queryKeys;
+    QVariantMap m_queryTimings;
+
+    // all candidates of the query, since the stems depend on the Hunspell dictionary, and dict
+    using ResultKey = QPair<QStringList, DictService *>;
+    QCache<ResultKey, QList<QJsonObject>> m_resultCache; // cost is the approximate size of results in bytes
+    QStringList m_collectingKeys;                            // candidates of the current query
+    QHash<DictService *, QList<QJsonObject>> m_collectedResults; // results of the current query to be cached
+    quint64 m_resultCacheHits = 0;
+    quint64 m_resultCacheMisses = 0;
+
+    bool m_unifiedIndexEnabled = false;
+    std::shared_ptr<const UnifiedIndex> m_unifiedIndex; // replaced as a whole by rebuilds
+    QHash<LocalDict *, uint32_t> m_unifiedSlots;        // slots of local dicts in the unified index
+    QHash<LocalDict *, int> m_unifiedVersions;          // bumped whenever a local dict is loaded or unloaded
+    uint32_t m_nextUnifiedSlot = 0;
+    QTimer m_unifiedIndexTimer;                         // coalesces rebuilds while dicts are loaded at startup
+    QThreadPool m_unifiedIndexPool;                     // runs one rebuild at a time
+    bool m_unifiedIndexBuilding = false;
+    bool m_unifiedIndexPending = false; // a rebuild was requested while another was running
+
     qreal m_dpScale = 1.0;
     qreal m_spScale = 1.0;
     qreal m_uiScale = 1.0;
@@ -0,0 +1,330 @@
+#include "stardictdict.h"
+#include "quickdict.h"
+#include "trace.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QtEndian>
+#include <cstring>
+
+namespace {
+
+/**
+ * @return field @p data of type @p type as HTML, an empty string for types which can't be shown.
+ */
+QString renderField(char type, const char *data, int size)
+{
+    switch (type) {
+    case 'h': // HTML
+    case 'g': // Pango markup
+    case 'x': // XDXF
+    case 'k': // KingSoft PowerWord XML
+        return QString::fromUtf8(data, size);
+    case 't': // phonetic
+        return QString("[%1]").arg(QString::fromUtf8(data, size).toHtmlEscaped());
+    case 'm': // plain text
+    case 'l': // ditto, in the locale's encoding, which is UTF-8 nowadays
+    case 'y': // Chinese YinBiao or Japanese kana
+    case 'w': // MediaWiki markup
+    case 'n': // WordNet
+        return QString::fromUtf8(data, size).toHtmlEscaped().replace('\n', "<br>");
+    default: // resource lists and binary data
+        return QString();
+    }
+}
+
+} // namespace
+
+StarDictDict::StarDictDict(QObject *parent)
+    : LocalDict(parent)
+{
+    m_dictIndex = new StarDictIndex;
+}
+
+StarDictDict::~StarDictDict()
+{
+    shutdown();
+    delete m_dictIndex;
+}
+
+void StarDictDict::setChunkCacheSize(int chunkCacheSize)
+{
+    if (chunkCacheSize == m_dictData.cacheSize())
+        return;
+    m_dictData.setCacheSize(chunkCacheSize);
+    emit chunkCacheSizeChanged(chunkCacheSize);
+}
+
+QVariantMap StarDictDict::chunkCacheStats() const
+{
+    return m_dictData.cacheStats();
+}
+
+bool StarDictDict::lookupKey(const QString &key, qint64 ordinal, int queryId)
+{
+    std::vector<StarDictEntry> values;
+    {
+        TraceSpan span(qdDict(), "findEntry", key);
+        values = ordinal < 0 ? m_dictIndex->findEntry(key) : m_dictIndex->valuesAt(ordinal);
+    }
+    if (values.empty())
+        return true;
+    qCDebug(qdDict) << "Dict:" << name() << "query:" << key << "count:" << values.size();
+    for (const StarDictEntry &entry : values) {
+        QByteArray data = m_dictData.read(entry.first, entry.second);
+        if (data.isNull()) {
+            qCWarning(qdDict) << "Dict:" << name() << "error: Invalid definition offset" << entry.first;
+            continue;
+        }
+
+        QJsonObject result{
+            {"engine", name()}, {"text", key}, {"result", definition(data)}, {"type", "lookup"}, {"id", queryId}};
+        emit queryResult(result);
+    }
+
+    return true;
+}
+
+void StarDictDict::forEachKey(const std::function<bool(const QString &, quint32)> &visit) const
+{
+    m_dictIndex->forEachKey([&visit](const StarDictKey &key, size_t ordinal) { return visit(key, ordinal); });
+}
+
+QStringList StarDictDict::findPrefix(const QString &prefix, int limit) const
+{
+    QStringList l;
+    for (const StarDictKey &key : m_dictIndex->findPrefix(prefix, limit))
+        l.append(key);
+    return l;
+}
+
+bool StarDictDict::containsKey(const QString &key) const
+{
+    return m_dictIndex->contains(key);
+}
+
+QStringList StarDictDict::findFuzzy(const QString &key, int maxDistance, int limit) const
+{
+    QStringList l;
+    for (const auto &match : m_dictIndex->findFuzzy(key, maxDistance, limit))
+        l.append(match.first);
+    return l;
+}
+
+bool StarDictDict::readInfo()
+{
+    QFile infoFile(m_dictFileName);
+    if (!infoFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qCWarning(qdDict) << "Dict:" << name() << "error: Failed to open file" << m_dictFileName;
+        return false;
+    }
+    if (infoFile.readLine().trimmed() != "StarDict's dict ifo file") {
+        qCWarning(qdDict) << "Dict:" << name() << "error: Not a StarDict .ifo file" << m_dictFileName;
+        return false;
+    }
+    m_info.clear();
+    while (!infoFile.atEnd()) {
+        QString line = QString::fromUtf8(infoFile.readLine()).trimmed();
+        int separator = line.indexOf('=');
+        if (separator > 0)
+            m_info.insert(line.left(separator).trimmed(), line.mid(separator + 1).trimmed());
+    }
+    m_sameTypeSequence = m_info.value("sametypesequence").toString();
+    // only version 3.0.0 may have 64-bit offsets
+    m_offsetBits64 = m_info.value("idxoffsetbits").toInt() == 64;
+    return true;
+}
+
+QString StarDictDict::siblingFile(const QStringList &suffixes) const
+{
+    QFileInfo infoFileInfo(m_dictFileName);
+    QString baseName = infoFileInfo.dir().filePath(infoFileInfo.completeBaseName());
+    for (const QString &suffix : suffixes) {
+        if (QFileInfo::exists(baseName + suffix))
+            return baseName + suffix;
+    }
+    return QString();
+}
+
+QString StarDictDict::definition(const QByteArray &data) const
+{
+    QStringList fields;
+    const char *p = data.constData();
+    const char *end = p + data.size();
+    // without `sametypesequence`, every field starts with its type
+    const bool ownTypes = m_sameTypeSequence.isEmpty();
+    for (int i = 0; p < end && (ownTypes || i < m_sameTypeSequence.size()); ++i) {
+        char type = ownTypes ? *p++ : m_sameTypeSequence[i].toLatin1();
+        const char *field = p;
+        qint64 size;
+        if (!ownTypes && i == m_sameTypeSequence.size() - 1) {
+            // the last field of a `sametypesequence` has neither terminator nor size
+            size = end - p;
+            p = end;
+        } else if (type >= 'a' && type <= 'z') {
+            const char *terminator = static_cast<const char *>(memchr(p, 0, end - p));
+            size = (terminator ? terminator : end) - p;
+            p = terminator ? terminator + 1 : end;
+        } else {
+            if (end - p < 4)
+                break;
+            size = qFromBigEndian<quint32>(p);
+            field = p += 4;
+            if (size > end - p)
+                break;
+            p += size;
+        }
+        QString html = renderField(type, field, size);
+        if (!html.isEmpty())
+            fields.append(html);
+    }
+    return fields.join("<br>");
+}
+
+bool StarDictDict::loadDict()
+{
+    if (!readInfo())
+        return false;
+
+    QString dictFileName = siblingFile({".dict.dz", ".dict"});
+    if (dictFileName.isEmpty()) {
+        qCWarning(qdDict) << "Dict:" << name() << "error: No .dict.dz or .dict file next to" << m_dictFileName;
+        return false;
+    }
+    if (!m_dictData.open(dictFileName)) {
+        qCWarning(qdDict) << "Dict:" << name() << "error:" << m_dictData.errorString();
+        return false;
+    }
+
+    qCDebug(qdDict) << "Dict:" << name() << "book:" << m_info.value("bookname").toString()
+                    << "entries:" << m_info.value("wordcount").toULongLong()
+                    << "synonyms:" << m_info.value("synwordcount").toULongLong()
+                    << "compressed:" << m_dictData.isCompressed();
+
+    return true;
+}
+
+bool StarDictDict::unloadDict()
+{
+    m_dictData.close();
+    m_info.clear();
+    return true;
+}
+
+bool StarDictDict::buildIndex()
+{
+    qCDebug(qdDict) << "Dict:" << name() << "status: Building indexes...";
+
+    QString idxFileName = siblingFile({".idx", ".idx.gz"});
+    QByteArray idx;
+    bool read;
+    if (idxFileName.endsWith(".gz")) {
+        read = DictZipFile::readGzip(idxFileName, idx);
+    } else {
+        QFile idxFile(idxFileName);
+        read = idxFile.open(QIODevice::ReadOnly);
+        idx = idxFile.readAll();
+    }
+    if (idxFileName.isEmpty() || !read) {
+        qCWarning(qdDict) << "Dict:" << name() << "error: Failed to read the .idx file of" << m_dictFileName;
+        return false;
+    }
+
+    // headwords, each followed by the offset and size of its definition in big endian
+    std::vector<std::pair<const char *, StarDictEntry>> words;
+    words.reserve(m_info.value("wordcount").toULongLong() + m_info.value("synwordcount").toULongLong());
+    const int offsetSize = m_offsetBits64 ? 8 : 4;
+    for (const char *p = idx.constData(), *end = p + idx.size(); p < end;) {
+        const char *terminator = static_cast<const char *>(memchr(p, 0, end - p));
+        if (!terminator || end - terminator - 1 < offsetSize + 4) {
+            qCWarning(qdDict) << "Dict:" << name() << "error: Invalid .idx file" << idxFileName;
+            return false;
+        }
+        const char *q = terminator + 1;
+        uint64_t offset = m_offsetBits64 ? qFromBigEndian<quint64>(q) : qFromBigEndian<quint32>(q);
+        uint32_t size = qFromBigEndian<quint32>(q + offsetSize);
+        words.emplace_back(p, StarDictEntry(offset, size));
+        p = q + offsetSize + 4;
+    }
+    const size_t headwordCount = words.size();
+    reportProgress(0.2);
+
+    // synonyms, each followed by the number of its headword in the .idx file in big endian
+    QByteArray syn;
+    QString synFileName = siblingFile({".syn"});
+    if (!synFileName.isEmpty()) {
+        QFile synFile(synFileName);
+        if (synFile.open(QIODevice::ReadOnly))
+            syn = synFile.readAll();
+        size_t invalid = 0;
+        for (const char *p = syn.constData(), *end = p + syn.size(); p < end;) {
+            const char *terminator = static_cast<const char *>(memchr(p, 0, end - p));
+            if (!terminator || end - terminator - 1 < 4)
+                break;
+            quint32 index = qFromBigEndian<quint32>(terminator + 1);
+            if (index < headwordCount) {
+                StarDictEntry entry = words[index].second; // `words` may grow into new storage
+                words.emplace_back(p, entry);
+            } else {
+                ++invalid;
+            }
+            p = terminator + 1 + 4;
+        }
+        if (invalid)
+            qCWarning(qdDict) << "Dict:" << name() << "error:" << invalid << "synonyms of missing headwords";
+    }
+    reportProgress(0.3);
+
+    // synonyms are appended to the sorted headwords
+    bool needSort = !sorted() || words.size() > headwordCount;
+#if defined(ENABLE_OPENCC) || defined(ENABLE_UNAC)
+    needSort = true;
+#endif
+    auto make = [&words](size_t i, StarDictKey &key, StarDictEntry &entry) {
+        key = QuickDict::instance()->normalizeKey(std::string(words[i].first));
+        entry = words[i].second;
+    };
+    auto entries = makeEntries<StarDictKey, StarDictEntry>(words.size(), needSort, make);
+    words = decltype(words)();
+    idx = syn = QByteArray();
+    reportProgress(0.5);
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (!m_dictIndex->addEntry(entries[i].first, entries[i].second)) {
+            qCWarning(qdDict) << "Dict:" << name() << "error: Failed to build indexes";
+            m_dictIndex->clear();
+            return false;
+        }
+        if (i % 65536 == 0)
+            reportProgress(0.5 + 0.4 * i / entries.size());
+    }
+    entries = decltype(entries)();
+
+    qCDebug(qdDict) << "Dict:" << name() << "status: Minimizing indexes...";
+    m_dictIndex->finish();
+    reportProgress(0.95);
+    qCInfo(qdDict) << "Dict:" << name() << "keys:" << m_dictIndex->keyCount()
+                   << "nodes:" << m_dictIndex->trieNodeCount() << "->" << m_dictIndex->nodeCount();
+
+    // without a saved index, the one in memory still serves until the next start
+    saveIndex(m_dictIndex);
+    return true;
+}
+
+bool StarDictDict::loadIndex()
+{
+    qCDebug(qdDict) << "Dict:" << name() << "status: Loading indexes...";
+
+    if (!m_dictIndex->map(m_indexFileName)) {
+        qCWarning(qdDict) << "Dict:" << name() << "error: Failed to map index file" << m_indexFileName;
+        return false;
+    }
+    qCDebug(qdDict) << "Dict:" << name() << "keys:" << m_dictIndex->keyCount() << "bytes:" << m_dictIndex->byteCount();
+
+    return true;
+}
+
+bool StarDictDict::unloadIndex()
+{
+    m_dictIndex->clear();
+    return true;
+}
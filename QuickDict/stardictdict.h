@@ -0,0 +1,76 @@
+#ifndef STARDICTDICT_H
+#define STARDICTDICT_H
+
+#include "dictindex.h"
+#include "dictzipfile.h"
+#include "localdict.h"
+#include <QVariantMap>
+
+using StarDictKey = QString;
+using StarDictEntry = std::pair<uint64_t, uint32_t>; // offset and size of the definition in the .dict file
+using StarDictIndex = DictIndex<StarDictKey, StarDictEntry>;
+
+/**
+ * StarDictDict reads StarDict dictionaries. `source` is the .ifo file, next to which the .idx (or .idx.gz), the
+ * optional .syn and the .dict.dz (or .dict) files are expected.
+ *
+ * Headwords of the .idx file and synonyms of the .syn file are indexed together, definitions are read from the
+ * .dict.dz file chunk by chunk, see `DictZipFile`.
+ */
+class StarDictDict : public LocalDict
+{
+    Q_OBJECT
+    Q_PROPERTY(int chunkCacheSize READ chunkCacheSize WRITE setChunkCacheSize NOTIFY chunkCacheSizeChanged)
+
+public:
+    explicit StarDictDict(QObject *parent = nullptr);
+    virtual ~StarDictDict();
+
+    /**
+     * @return maximum bytes of inflated .dict.dz chunks kept in memory.
+     */
+    inline int chunkCacheSize() const { return m_dictData.cacheSize(); }
+    void setChunkCacheSize(int chunkCacheSize);
+    /**
+     * @return hits, misses, hit rate and current usage of the chunk cache.
+     */
+    Q_INVOKABLE QVariantMap chunkCacheStats() const;
+
+    QStringList findPrefix(const QString &prefix, int limit) const override;
+    bool containsKey(const QString &key) const override;
+    QStringList findFuzzy(const QString &key, int maxDistance, int limit) const override;
+
+Q_SIGNALS:
+    void chunkCacheSizeChanged(int chunkCacheSize);
+
+protected:
+    bool lookupKey(const QString &key, qint64 ordinal, int queryId) override;
+    void forEachKey(const std::function<bool(const QString &, quint32)> &visit) const override;
+    bool loadDict() override;
+    bool unloadDict() override;
+    bool buildIndex() override;
+    bool loadIndex() override;
+    bool unloadIndex() override;
+    /**
+     * Reads the key=value lines of the .ifo file.
+     * @return @c true if successful, @c false otherwise.
+     */
+    bool readInfo();
+    /**
+     * @return the first of @p suffixes appended to the base name of the .ifo file which names an existing file, an
+     * empty string if none does.
+     */
+    QString siblingFile(const QStringList &suffixes) const;
+    /**
+     * @return @p data, which is made of fields typed by `sametypesequence` or by their own type characters, as HTML.
+     */
+    QString definition(const QByteArray &data) const;
+
+    QVariantMap m_info; // from the .ifo file
+    QString m_sameTypeSequence;
+    bool m_offsetBits64 = false;
+    DictZipFile m_dictData;
+    StarDictIndex *m_dictIndex = nullptr;
+};
+
+#endif // STARDICTDICT_H
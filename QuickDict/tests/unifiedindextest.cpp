@@ -0,0 +1,100 @@
+/*
+ * Checks that `UnifiedIndex::lookup` resolves queries for every dict as `LocalDict::lookupKeys` does on the dict's
+ * own index.
+ */
+
+#include "unifiedindex.h"
+
+#include <QtTest>
+
+Q_LOGGING_CATEGORY(qdDict, "qd.dict")
+
+namespace {
+
+/**
+ * @return an enumerator of @p keys, which must be sorted, with their positions as ordinals.
+ */
+UnifiedIndex::KeyEnumerator enumerator(const QStringList &keys)
+{
+    return [keys](const std::function<bool(const QString &, quint32)> &visit) {
+        for (int i = 0; i < keys.size(); ++i) {
+            if (!visit(keys[i], i))
+                break;
+        }
+        return true;
+    };
+}
+
+/**
+ * @return hits of @p candidates in a dict of @p keys, following the rules of `LocalDict::lookupKeys`.
+ */
+QList<LocalDictHit> expectedHits(const QStringList &keys, const QStringList &candidates)
+{
+    DictIndex<QString, int> index;
+    for (int i = 0; i < keys.size(); ++i)
+        index.addEntry(keys[i], i);
+    index.finish();
+
+    const QString &key = candidates.first();
+    if (index.contains(key))
+        return QList<LocalDictHit>{LocalDictHit(key, keys.indexOf(key))};
+    QList<LocalDictHit> hits;
+    for (int i = 1; i < candidates.size(); ++i) {
+        if (index.contains(candidates[i]))
+            hits.append(LocalDictHit(candidates[i], keys.indexOf(candidates[i])));
+    }
+    if (!hits.isEmpty())
+        return hits;
+    for (const auto &match : index.findFuzzy(key, key.size() <= 4 ? 1 : 2, 5))
+        hits.append(LocalDictHit(match.first, keys.indexOf(match.first)));
+    return hits;
+}
+
+} // namespace
+
+class UnifiedIndexTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void lookup_data();
+    void lookup();
+};
+
+void UnifiedIndexTest::lookup_data()
+{
+    QTest::addColumn<QStringList>("near");
+    QTest::addColumn<QStringList>("far");
+    QTest::addColumn<QStringList>("candidates");
+
+    // more keys one edit away in the first dict than all dicts together get suggestions, and only keys two edits away
+    // in the second
+    const QStringList near{
+        "bello", "cello", "fello", "hallo", "helli", "hellp", "hells", "hellx", "jello", "mello", "yello"};
+    const QStringList far{"halls", "help"};
+    QTest::newRow("fuzzy") << near << far << QStringList{"hello"};
+    QTest::newRow("key in one dict") << near << far << QStringList{"hells"};
+    QTest::newRow("stem in one dict") << near << far << QStringList{"helps", "help"};
+}
+
+void UnifiedIndexTest::lookup()
+{
+    QFETCH(QStringList, near);
+    QFETCH(QStringList, far);
+    QFETCH(QStringList, candidates);
+
+    QVector<UnifiedIndex::Source> sources{{0, 0, enumerator(near)}, {1, 0, enumerator(far)}};
+    std::shared_ptr<const UnifiedIndex> index = UnifiedIndex::build(nullptr, sources);
+    QVERIFY(index);
+    QHash<uint32_t, QList<LocalDictHit>> hits = index->lookup(candidates);
+
+    QList<LocalDictHit> nearHits = expectedHits(near, candidates);
+    QList<LocalDictHit> farHits = expectedHits(far, candidates);
+    QVERIFY(!farHits.isEmpty());
+    QCOMPARE(hits.value(0), nearHits);
+    QCOMPARE(hits.value(1), farHits);
+}
+
+QTEST_GUILESS_MAIN(UnifiedIndexTest)
+
+#include "unifiedindextest.moc"
@@ -0,0 +1,164 @@
+#include "trace.h"
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QThread>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+QAtomicInt Trace::_enabled = 0;
+
+namespace {
+
+struct TraceEvent
+{
+    const char *category;
+    const char *name;
+    char phase; // 'X' for spans, 'i' for instant events
+    qint64 begin;
+    qint64 duration;
+    QString detail;
+};
+
+struct TraceBuffer
+{
+    QMutex mutex; // only contended while saving
+    std::vector<TraceEvent> events;
+    quint64 dropped = 0;
+    quint64 threadId = 0;
+    QString threadName;
+};
+
+const size_t MaxEventsPerThread = 1 << 20; // bounds memory of a long session, later events are dropped
+
+QMutex buffersMutex;
+std::vector<std::shared_ptr<TraceBuffer>> buffers; // kept after their threads finish, until saved or cleared
+
+/**
+ * @return @c true if the thread of @p buffer has finished, only `buffers` still refers to it then. Pool threads expire
+ * and respawn, so their buffers are dropped once saved or cleared, not to pile up.
+ */
+inline bool finished(const std::shared_ptr<TraceBuffer> &buffer)
+{
+    return buffer.use_count() == 1;
+}
+
+TraceBuffer *threadBuffer()
+{
+    thread_local std::shared_ptr<TraceBuffer> buffer;
+    if (!buffer) {
+        buffer = std::make_shared<TraceBuffer>();
+        QThread *thread = QThread::currentThread();
+        buffer->threadId = reinterpret_cast<quintptr>(QThread::currentThreadId());
+        if (qApp && thread == qApp->thread())
+            buffer->threadName = "main";
+        else if (!thread->objectName().isEmpty())
+            buffer->threadName = thread->objectName();
+        else
+            buffer->threadName = QString("thread %1").arg(buffer->threadId);
+        QMutexLocker locker(&buffersMutex);
+        buffers.push_back(buffer);
+    }
+    return buffer.get();
+}
+
+void record(TraceEvent &&event)
+{
+    TraceBuffer *buffer = threadBuffer();
+    QMutexLocker locker(&buffer->mutex);
+    if (buffer->events.size() < MaxEventsPerThread)
+        buffer->events.push_back(std::move(event));
+    else
+        ++buffer->dropped;
+}
+
+} // namespace
+
+void Trace::setEnabled(bool enabled)
+{
+    now(); // starts the clock
+    _enabled.storeRelaxed(enabled);
+}
+
+qint64 Trace::now()
+{
+    using Clock = std::chrono::steady_clock;
+    static const Clock::time_point origin = Clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - origin).count();
+}
+
+void Trace::complete(
+    const QLoggingCategory &category, const char *name, qint64 begin, qint64 end, const QString &detail)
+{
+    record(TraceEvent{category.categoryName(), name, 'X', begin, end - begin, detail});
+}
+
+void Trace::instant(const QLoggingCategory &category, const char *name, const QString &detail)
+{
+    if (isEnabled())
+        record(TraceEvent{category.categoryName(), name, 'i', now(), 0, detail});
+}
+
+int Trace::save(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return -1;
+
+    // written event by event, a trace of a long session doesn't fit in a QJsonDocument comfortably
+    const qint64 pid = QCoreApplication::applicationPid();
+    int count = 0;
+    auto write = [&file, &count](const QJsonObject &object) {
+        file.write(count++ ? ",\n" : "\n");
+        file.write(QJsonDocument(object).toJson(QJsonDocument::Compact));
+    };
+    file.write("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    QMutexLocker locker(&buffersMutex);
+    std::vector<std::shared_ptr<TraceBuffer>> unfinished;
+    for (const std::shared_ptr<TraceBuffer> &buffer : buffers) {
+        QMutexLocker bufferLocker(&buffer->mutex);
+        // checked before writing, a thread still running may record more events until the next save
+        if (!finished(buffer))
+            unfinished.push_back(buffer);
+        write(QJsonObject{{"name", "thread_name"},
+                          {"ph", "M"},
+                          {"pid", pid},
+                          {"tid", static_cast<qint64>(buffer->threadId)},
+                          {"args", QJsonObject{{"name", buffer->threadName}}}});
+        for (const TraceEvent &event : buffer->events) {
+            QJsonObject object{{"name", event.name},
+                               {"cat", event.category},
+                               {"ph", QString(QLatin1Char(event.phase))},
+                               {"ts", event.begin},
+                               {"pid", pid},
+                               {"tid", static_cast<qint64>(buffer->threadId)}};
+            if (event.phase == 'X')
+                object["dur"] = event.duration;
+            else
+                object["s"] = "t"; // scoped to the thread
+            if (!event.detail.isEmpty())
+                object["args"] = QJsonObject{{"detail", event.detail}};
+            write(object);
+        }
+        if (buffer->dropped)
+            qWarning() << "Trace: dropped" << buffer->dropped << "events of thread" << buffer->threadName;
+    }
+    buffers.swap(unfinished);
+    file.write("\n]}\n");
+    return file.error() == QFileDevice::NoError ? count : -1;
+}
+
+void Trace::clear()
+{
+    QMutexLocker locker(&buffersMutex);
+    buffers.erase(std::remove_if(buffers.begin(), buffers.end(), finished), buffers.end());
+    for (const std::shared_ptr<TraceBuffer> &buffer : buffers) {
+        QMutexLocker bufferLocker(&buffer->mutex);
+        buffer->events.clear();
+        buffer->dropped = 0;
+    }
+}
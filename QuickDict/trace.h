@@ -0,0 +1,80 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QAtomicInt>
+#include <QLoggingCategory>
+#include <QString>
+
+/**
+ * Trace records how long the stages of a query take, e.g. grabbing the screen, OCR, normalization and lookups, and
+ * saves them in the Chrome trace event format, which can be opened by chrome://tracing or https://ui.perfetto.dev.
+ *
+ * Events are grouped by the logging category of the stage. Recording is off by default and costs a single atomic
+ * load per span then. Every thread records into its own buffer, so threads don't contend while recording.
+ */
+class Trace
+{
+public:
+    static inline bool isEnabled() { return _enabled.loadRelaxed(); }
+    /**
+     * Starts or stops recording. Recorded events are kept until `clear`.
+     */
+    static void setEnabled(bool enabled);
+    /**
+     * @return microseconds since tracing was first enabled.
+     */
+    static qint64 now();
+    /**
+     * Records a span of @p name from @p begin to @p end, see `now`. @p name must outlive the trace, e.g. a literal.
+     */
+    static void complete(const QLoggingCategory &category,
+                         const char *name,
+                         qint64 begin,
+                         qint64 end,
+                         const QString &detail = QString());
+    /**
+     * Records an event of @p name at this moment.
+     */
+    static void instant(const QLoggingCategory &category, const char *name, const QString &detail = QString());
+    /**
+     * Writes all recorded events to @p fileName as JSON. Events of threads which have finished are released then.
+     * @return number of events written, -1 if the file can't be written.
+     */
+    static int save(const QString &fileName);
+    static void clear();
+
+private:
+    static QAtomicInt _enabled;
+};
+
+/**
+ * Records the time from its construction to its destruction as a span, if tracing is enabled when constructed.
+ */
+class TraceSpan
+{
+public:
+    TraceSpan(const QLoggingCategory &category, const char *name, const QString &detail = QString())
+        : m_category(category)
+        , m_name(name)
+    {
+        if (Trace::isEnabled()) {
+            m_detail = detail;
+            m_begin = Trace::now();
+        }
+    }
+    ~TraceSpan()
+    {
+        if (m_begin >= 0)
+            Trace::complete(m_category, m_name, m_begin, Trace::now(), m_detail);
+    }
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+    const QLoggingCategory &m_category;
+    const char *m_name;
+    QString m_detail;
+    qint64 m_begin = -1;
+};
+
+#endif // TRACE_H
@@ -0,0 +1,115 @@
+#include "unifiedindex.h"
+#include <QElapsedTimer>
+#include <algorithm>
+#include <limits>
+
+std::shared_ptr<const UnifiedIndex> UnifiedIndex::build(const std::shared_ptr<const UnifiedIndex> &base,
+                                                        const QVector<Source> &sources)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    std::shared_ptr<UnifiedIndex> index = std::make_shared<UnifiedIndex>();
+    std::vector<std::pair<UnifiedKey, UnifiedValue>> entries;
+    std::vector<size_t> bounds{0}; // every run of entries is sorted by key
+    size_t reused = 0;
+
+    // entries of dicts which haven't changed since `base` was built
+    QHash<uint32_t, int> kept;
+    for (const Source &source : sources) {
+        if (base && base->version(source.slot) == source.version)
+            kept.insert(source.slot, source.version);
+    }
+    if (!kept.isEmpty()) {
+        base->m_index.forEachKey([&](const UnifiedKey &key, size_t ordinal) {
+            for (const UnifiedValue &value : base->m_index.valuesAt(ordinal)) {
+                if (kept.contains(value.first))
+                    entries.emplace_back(key, value);
+            }
+            return true;
+        });
+        reused = entries.size();
+        bounds.push_back(entries.size());
+        index->m_versions = kept;
+    }
+
+    // entries of the other dicts, read from their own indexes
+    for (const Source &source : sources) {
+        if (kept.contains(source.slot))
+            continue;
+        bool loaded = source.enumerateKeys([&](const QString &key, quint32 ordinal) {
+            entries.emplace_back(key, UnifiedValue(source.slot, ordinal));
+            return true;
+        });
+        if (!loaded) {
+            entries.resize(bounds.back());
+            continue;
+        }
+        bounds.push_back(entries.size());
+        index->m_versions.insert(source.slot, source.version);
+    }
+    if (index->m_versions.isEmpty())
+        return nullptr;
+
+    // merge the runs pairwise, keeping the order of values of the same key
+    auto less = [](const auto &lhs, const auto &rhs) { return lhs.first < rhs.first; };
+    while (bounds.size() > 2) {
+        std::vector<size_t> merged{0};
+        for (size_t i = 0; i + 2 < bounds.size(); i += 2) {
+            std::inplace_merge(entries.begin() + bounds[i],
+                               entries.begin() + bounds[i + 1],
+                               entries.begin() + bounds[i + 2],
+                               less);
+            merged.push_back(bounds[i + 2]);
+        }
+        if (bounds.size() % 2 == 0)
+            merged.push_back(bounds.back());
+        bounds.swap(merged);
+    }
+
+    for (const auto &entry : entries)
+        index->m_index.addEntry(entry.first, entry.second);
+    entries = decltype(entries)();
+    index->m_index.finish();
+
+    qCInfo(qdDict) << "UnifiedIndex: dicts:" << index->m_versions.size() << "keys:" << index->keyCount()
+                   << "reused entries:" << reused << "bytes:" << index->byteCount() << "time:" << timer.elapsed()
+                   << "ms";
+    return index;
+}
+
+QHash<uint32_t, QList<LocalDictHit>> UnifiedIndex::lookup(const QStringList &candidates) const
+{
+    QHash<uint32_t, QList<LocalDictHit>> hits;
+    if (candidates.isEmpty())
+        return hits;
+
+    // the key itself
+    const QString &key = candidates.first();
+    for (const UnifiedValue &value : m_index.findEntry(key))
+        hits[value.first].append(LocalDictHit(key, value.second));
+    QHash<uint32_t, QList<LocalDictHit>> found = hits;
+
+    // stems, for dicts without the key
+    for (int i = 1; i < candidates.size(); ++i) {
+        for (const UnifiedValue &value : m_index.findEntry(candidates[i])) {
+            if (!found.contains(value.first))
+                hits[value.first].append(LocalDictHit(candidates[i], value.second));
+        }
+    }
+    found = hits;
+
+    // closest keys, for dicts with neither the key nor stems, uncapped since the closest keys of one dict may all be
+    // farther away than many keys of the others
+    if (found.size() < m_versions.size()) {
+        const int limit = 5; // per dict
+        auto matches = m_index.findFuzzy(key, key.size() <= 4 ? 1 : 2, std::numeric_limits<size_t>::max());
+        for (const auto &match : matches) {
+            for (const UnifiedValue &value : m_index.findEntry(match.first)) {
+                if (!found.contains(value.first) && hits[value.first].size() < limit)
+                    hits[value.first].append(LocalDictHit(match.first, value.second));
+            }
+        }
+    }
+    return hits;
+}
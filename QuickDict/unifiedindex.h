@@ -0,0 +1,67 @@
+#ifndef UNIFIEDINDEX_H
+#define UNIFIEDINDEX_H
+
+#include "dictindex.h"
+#include "localdict.h"
+#include <QHash>
+#include <QVector>
+#include <functional>
+#include <memory>
+
+using UnifiedKey = QString;
+using UnifiedValue = std::pair<uint32_t, uint32_t>; // slot of the dict, ordinal of the key in the dict
+using UnifiedDictIndex = DictIndex<UnifiedKey, UnifiedValue>;
+
+/**
+ * UnifiedIndex merges the indexes of several local dicts, so that a query walks a single index instead of one per
+ * dict. Every key maps to the dicts having it, and to its ordinal in each of them, which lets the dicts read their
+ * entries without walking their own indexes again.
+ *
+ * Dicts are identified by slots. Every slot has a version, which is bumped whenever the dict is loaded again, so that
+ * outdated entries are never used. An index is immutable once built; `build` creates a new one from a previous index
+ * and reads only the dicts that are new or have changed since. Only gathering the entries is incremental, the DAWG
+ * itself is built anew from all of them.
+ */
+class UnifiedIndex
+{
+public:
+    /**
+     * Visits the keys of a dict like `LocalDict::enumerateKeys`.
+     */
+    using KeyEnumerator = std::function<bool(const std::function<bool(const QString &, quint32)> &)>;
+
+    struct Source
+    {
+        uint32_t slot;
+        int version;
+        KeyEnumerator enumerateKeys;
+    };
+
+    /**
+     * Builds an index of @p sources, reusing entries of @p base whose slot and version are still in @p sources.
+     * May run on any thread.
+     * @return the new index, @c nullptr if none of @p sources could be read.
+     */
+    static std::shared_ptr<const UnifiedIndex> build(const std::shared_ptr<const UnifiedIndex> &base,
+                                                     const QVector<Source> &sources);
+
+    /**
+     * Resolves a query for every dict, following the same rules as `LocalDict::lookupKeys`.
+     * @param candidates normalized keys of the query, see `QuickDict::queryKeys`.
+     * @return hits per slot, dicts without hits are left out.
+     */
+    QHash<uint32_t, QList<LocalDictHit>> lookup(const QStringList &candidates) const;
+
+    /**
+     * @return version of the dict in @p slot when the index was built, -1 if it isn't indexed.
+     */
+    inline int version(uint32_t slot) const { return m_versions.value(slot, -1); }
+    inline size_t keyCount() const { return m_index.keyCount(); }
+    inline size_t byteCount() const { return m_index.byteCount(); }
+
+private:
+    UnifiedDictIndex m_index;
+    QHash<uint32_t, int> m_versions;
+};
+
+#endif // UNIFIEDINDEX_H
@@ -2,7 +2,25 @@
 #define UTILS_H
 
 #include <stdio.h>
+#include <thread>
+#include <vector>
 
 FILE *fopen_unicode(const char *pathname, const char *mode);
 
+/**
+ * Calls @p func with 0, 1, ..., @p count - 1, each on its own thread, and waits for all of them.
+ */
+template<typename Func>
+void parallel_for(size_t count, Func &&func)
+{
+    std::vector<std::thread> threads;
+    threads.reserve(count);
+    for (size_t i = 1; i < count; ++i)
+        threads.emplace_back([&func, i]() { func(i); });
+    if (count > 0)
+        func(0);
+    for (auto &thread : threads)
+        thread.join();
+}
+
 #endif // UTILS_H
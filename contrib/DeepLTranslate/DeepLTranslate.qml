@@ -32,7 +32,7 @@ Dict {
             )
             .then(function (response) {
                 if (response.data.translations) {
-                    let result = {"engine": name, "text": "guess", "type": "lookup", "translation": response.data.translations[0]}
+                    let result = {"engine": name, "id": queryId, "text": "guess", "type": "lookup", "translation": response.data.translations[0]}
                     queryResult(result)
                 }
             })
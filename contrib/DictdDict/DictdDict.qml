@@ -7,7 +7,7 @@ Dict {
     property url url: "https://dict.org/bin/Dict?Form=Dict2&Database=*&Query="
 
     onQuery: {
-        let result = {"engine": name, "text": text, "type": "translation", "url": url + text}
+        let result = {"engine": name, "id": queryId, "text": text, "type": "translation", "url": url + text}
         queryResult(result)
     }
 }
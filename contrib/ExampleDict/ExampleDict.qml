@@ -15,7 +15,7 @@ Dict {
     }
 
     onQuery: {
-        let result = {"engine": name, "text": text, "result": "This is the result of Example Dict.", "type": "lookup"}
+        let result = {"engine": name, "id": queryId, "text": text, "result": "This is the result of Example Dict.", "type": "lookup"}
         queryResult(result)
     }
 }
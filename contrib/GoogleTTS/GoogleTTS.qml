@@ -32,7 +32,7 @@ Dict {
 
     onQuery: {
         let audioUrl = String(url).replace("(tl)", tl) + text
-        let result = {"engine": name, "text": text, "url": audioUrl, "autoPlay": autoPlay, "type": "lookup"}
+        let result = {"engine": name, "id": queryId, "text": text, "url": audioUrl, "autoPlay": autoPlay, "type": "lookup"}
         queryResult(result)
     }
 }
@@ -8,7 +8,7 @@ Dict {
     property string tl
 
     onQuery: {
-        let result = {"engine": name, "text": text, "type": "translation", "url": String(url).replace("(tl)", tl) + text}
+        let result = {"engine": name, "id": queryId, "text": text, "type": "translation", "url": String(url).replace("(tl)", tl) + text}
         queryResult(result)
     }
 
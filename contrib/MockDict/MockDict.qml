@@ -8,7 +8,7 @@ Dict {
 
     onQuery: {
         for (const source of Data.sources) {
-            queryResult(source)
+            queryResult(Object.assign({"id": queryId}, source))
         }
     }
 }
@@ -15,7 +15,7 @@ Dict {
         const reqDef = axiosInstance.get(`entries/${tl}/${text}?fields=definitions&strictMatch=${strictMatch}`)
         const reqPron = axiosInstance.get(`entries/${tl}/${text}?fields=pronunciations&strictMatch=${strictMatch}`)
         axios.all([reqDef, reqPron]).then(axios.spread((...responses) => {
-                let result = {"engine": name, "text": text, "type": "lookup", "definitions": []}
+                let result = {"engine": name, "id": queryId, "text": text, "type": "lookup", "definitions": []}
                 const lexicalEntries = responses[0].data.results[0].lexicalEntries
                 const respPron = responses[1].data.results[0].lexicalEntries
                 let pronunciations = {}
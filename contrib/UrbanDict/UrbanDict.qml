@@ -12,7 +12,7 @@ Dict {
                 if (!response.data.list.length)
                     return
 
-                let result = {"engine": name, "text": response.data.list[0].word, "type": "lookup"}
+                let result = {"engine": name, "id": queryId, "text": response.data.list[0].word, "type": "lookup"}
                 let definitions = {"list": []}
                 for (const entry of response.data.list) {
                     definitions.list.push({"definition": entry.definition, "examples": entry.example})
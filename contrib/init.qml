@@ -20,6 +20,7 @@ Item {
         name: "Example Mdx Dict"
         source: "/home/user/Dictionaries/Example_Mdx_Dict.mdx"
         delegate: dictDelegate
+        blockCacheSize: 16 * 1024 * 1024 // bytes of decompressed record blocks kept in memory
     }
     MobiDict {
         id: exampleMobiDict
@@ -27,6 +28,19 @@ Item {
         source: "/home/user/Dictionaries/Example_Mobi_Dict.mobi"
         delegate: dictDelegate
     }
+    StarDictDict {
+        id: exampleStarDictDict
+        name: "Example StarDict Dict"
+        source: "/home/user/Dictionaries/Example_StarDict_Dict/Example_StarDict_Dict.ifo" // .idx and .dict.dz beside it
+        delegate: dictDelegate
+        chunkCacheSize: 8 * 1024 * 1024 // bytes of inflated .dict.dz chunks kept in memory
+    }
+    DictdFileDict {
+        id: exampleDictdFileDict
+        name: "Example Dictd Dict"
+        source: "/usr/share/dictd/wn.index" // wn.dict.dz beside it, e.g. from the dict-wn package
+        delegate: dictDelegate
+    }
     UrbanDict.UrbanDict {
         id: urbanDict
     }
@@ -137,6 +151,11 @@ Item {
                 m.toggle()
         }
     }
+    Hotkey {
+        // start/stop tracing queries, the trace is saved to trace.json in the log dir when stopped
+        sequence: "Alt+T"
+        onActivated: qd.tracing = !qd.tracing
+    }
 
     Component {
         id: dictDelegate
@@ -154,6 +173,8 @@ Item {
     }
 
     Component.onCompleted: {
+        // each local dict looks up its own index, set it to true to merge them into one, which pays off with many dicts
+        qd.unifiedIndex = false
         // wait all components are loaded
         setTimeout(() => {
             mainPage = qd.findChild("mainPage", window)